@@ -341,9 +341,9 @@ static void mm_align_pair(void *km, const mm_mapopt_t *opt, int qlen, const uint
 static inline int mm_get_hplen_back(const mm_idx_t *mi, uint32_t rid, uint32_t x)
 {
 	int64_t i, off0 = mi->seq[rid].offset, off = off0 + x;
-	int c = mm_seq4_get(mi->S, off);
+	int c = mm_idx_base(mi, off);
 	for (i = off - 1; i >= off0; --i)
-		if (mm_seq4_get(mi->S, i) != c) break;
+		if (mm_idx_base(mi, i) != c) break;
 	return (int)(off - i);
 }
 
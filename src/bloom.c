@@ -0,0 +1,60 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "bloom.h"
+
+mm_bloom_t *mm_bloom_init(uint64_t n_elem, double fpr)
+{
+	mm_bloom_t *bf;
+	double bits;
+	if (n_elem < 1000) n_elem = 1000;
+	// bits per key of a plain bloom filter with MM_BLOOM_N_PROBE probes; the extra
+	// 10% compensates for the uneven load across blocks
+	bits = -MM_BLOOM_N_PROBE / log(1.0 - pow(fpr, 1.0 / MM_BLOOM_N_PROBE)) * 1.1;
+	bf = (mm_bloom_t*)calloc(1, sizeof(mm_bloom_t));
+	bf->n_blocks = (uint64_t)(n_elem * bits / 512.0) + 1;
+	bf->mem = calloc(bf->n_blocks * 8 + 8, 8);
+	bf->b = (uint64_t*)(((uintptr_t)bf->mem + 63) & ~(uintptr_t)63);
+	return bf;
+}
+
+void mm_bloom_destroy(mm_bloom_t *bf)
+{
+	if (bf == 0) return;
+	free(bf->mem);
+	free(bf);
+}
+
+void mm_bloom_dump(FILE *fp, const mm_bloom_t *bf)
+{
+	fwrite(&bf->n_blocks, 8, 1, fp);
+	fwrite(&bf->n, 8, 1, fp);
+	fwrite(bf->b, 64, bf->n_blocks, fp);
+}
+
+mm_bloom_t *mm_bloom_load(FILE *fp)
+{
+	mm_bloom_t *bf;
+	uint64_t x[2];
+	if (fread(x, 8, 2, fp) != 2) return 0;
+	bf = (mm_bloom_t*)calloc(1, sizeof(mm_bloom_t));
+	bf->n_blocks = x[0], bf->n = x[1];
+	bf->mem = malloc(bf->n_blocks * 64 + 64);
+	bf->b = (uint64_t*)(((uintptr_t)bf->mem + 63) & ~(uintptr_t)63);
+	if (fread(bf->b, 64, bf->n_blocks, fp) != bf->n_blocks) {
+		mm_bloom_destroy(bf);
+		return 0;
+	}
+	return bf;
+}
+
+double mm_bloom_fpr(const mm_bloom_t *bf, int n_probe)
+{
+	uint64_t x = 0x9e3779b97f4a7c15ULL;
+	int i, fp = 0;
+	for (i = 0; i < n_probe; ++i) {
+		x ^= x << 13, x ^= x >> 7, x ^= x << 17; // xorshift64
+		fp += mm_bloom_contains(bf, x | 1ULL<<63); // 2-bit k-mers never set the top bit
+	}
+	return n_probe > 0? (double)fp / n_probe : 0.0;
+}
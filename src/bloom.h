@@ -0,0 +1,99 @@
+#ifndef MM_BLOOM_H
+#define MM_BLOOM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Cache-line blocked bloom filter for 2-bit encoded k-mers. A k-mer is hashed
+ * once; the high 32 bits pick a 64-byte block and the low 32 bits, multiplied
+ * by eight odd salts, set one bit in each of the block's eight 64-bit words.
+ * A lookup therefore touches exactly one cache line.
+ */
+
+#define MM_BLOOM_N_PROBE 8
+
+typedef struct mm_bloom_s {
+	uint64_t n_blocks; // number of 64-byte blocks
+	uint64_t n;        // number of inserted k-mers
+	uint64_t *b;       // n_blocks * 8 words, aligned to 64 bytes
+	void *mem;         // raw allocation backing $b
+} mm_bloom_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Allocate an empty filter sized for $n_elem k-mers at false positive rate $fpr
+ */
+mm_bloom_t *mm_bloom_init(uint64_t n_elem, double fpr);
+
+void mm_bloom_destroy(mm_bloom_t *bf);
+
+/**
+ * Estimate the false positive rate by probing $n_probe keys that cannot be k-mers
+ */
+double mm_bloom_fpr(const mm_bloom_t *bf, int n_probe);
+
+void mm_bloom_dump(FILE *fp, const mm_bloom_t *bf);
+mm_bloom_t *mm_bloom_load(FILE *fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+static const uint32_t mm_bloom_salt[MM_BLOOM_N_PROBE] = {
+	0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+	0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+// splitmix64 finalizer; deliberately unrelated to the hashes used for minimizer ordering
+static inline uint64_t mm_bloom_hash(uint64_t x)
+{
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+static inline uint64_t *mm_bloom_block(const mm_bloom_t *bf, uint64_t h)
+{
+	return &bf->b[((h >> 32) * bf->n_blocks >> 32) << 3];
+}
+
+static inline void mm_bloom_prefetch(const mm_bloom_t *bf, uint64_t kmer)
+{
+	__builtin_prefetch(mm_bloom_block(bf, mm_bloom_hash(kmer)));
+}
+
+static inline void mm_bloom_insert(mm_bloom_t *bf, uint64_t kmer)
+{
+	uint64_t h = mm_bloom_hash(kmer), *p = mm_bloom_block(bf, h);
+	int i;
+	for (i = 0; i < MM_BLOOM_N_PROBE; ++i)
+		p[i] |= 1ULL << ((uint32_t)h * mm_bloom_salt[i] >> 26);
+	++bf->n;
+}
+
+// thread-safe variant of mm_bloom_insert(); the caller accounts for $n
+static inline void mm_bloom_insert_atomic(mm_bloom_t *bf, uint64_t kmer)
+{
+	uint64_t h = mm_bloom_hash(kmer), *p = mm_bloom_block(bf, h);
+	int i;
+	for (i = 0; i < MM_BLOOM_N_PROBE; ++i) {
+		uint64_t bit = 1ULL << ((uint32_t)h * mm_bloom_salt[i] >> 26);
+		if (!(p[i] & bit)) __sync_fetch_and_or(&p[i], bit);
+	}
+}
+
+static inline int mm_bloom_contains(const mm_bloom_t *bf, uint64_t kmer)
+{
+	uint64_t h = mm_bloom_hash(kmer), r = 1;
+	const uint64_t *p = mm_bloom_block(bf, h);
+	int i;
+	for (i = 0; i < MM_BLOOM_N_PROBE; ++i)
+		r &= p[i] >> ((uint32_t)h * mm_bloom_salt[i] >> 26);
+	return (int)r;
+}
+
+#endif
@@ -19,13 +19,94 @@ static inline int ilog2_32(uint32_t v)
 	return (t = v>>8) ? 8 + LogTable256[t] : LogTable256[v];
 }
 
-mm128_t *mm_chain_dp(int max_dist_x, int min_dist_x, int max_dist_y, int bw, int max_skip, int max_iter, int min_cnt, int min_sc, float gap_scale, int is_cdna, int n_segs, int64_t n, mm128_t *a, int *n_u_, uint64_t **_u, void *km)
+/*
+ * Incremental chaining (--chain-inc). As a stage-1 window grows, the query
+ * coordinates of the anchors on one strand stay put: those of the forward
+ * strand if the window grows to the right, of the reverse strand if it grows
+ * to the left. An anchor on that strand chained in the previous call can
+ * only take a new predecessor if it lies after, on the query, an anchor that
+ * was added or dropped since; otherwise its score and predecessor are kept.
+ * The rest are scored again. The kept scores saw the previous max_iter
+ * window and average seed span, so results may differ slightly.
+ */
+
+// mark in $done the anchors of $a whose state is taken from $inc, and set their f[], p[] and v[]
+static void chain_inc_reuse(void *km, const mm_chain_inc_t *inc, int64_t n, const mm128_t *a, int32_t *f, int32_t *p, int32_t *v, uint8_t *done)
+{
+	const mm128_t *b = inc->a;
+	uint64_t rev = (uint64_t)inc->rev << 63;
+	int64_t i, j, i0, j0, i1, j1, ie, je, ii, jj;
+	int32_t q_min = INT32_MAX, *m;
+
+	for (i0 = 0; i0 < n && (a[i0].x & 1ULL<<63) < rev; ++i0);
+	for (i1 = i0; i1 < n && (a[i1].x & 1ULL<<63) == rev; ++i1);
+	for (j0 = 0; j0 < inc->n && (b[j0].x & 1ULL<<63) < rev; ++j0);
+	for (j1 = j0; j1 < inc->n && (b[j1].x & 1ULL<<63) == rev; ++j1);
+	m = (int32_t*)kmalloc(km, inc->n * 4);
+	for (j = 0; j < inc->n; ++j) m[j] = -1;
+
+	// match the anchors of the two calls; both are sorted by x
+	for (i = i0, j = j0; i < i1 || j < j1; i = ie, j = je) {
+		if (j == j1 || (i < i1 && a[i].x < b[j].x)) ie = i + 1, je = j;
+		else if (i == i1 || b[j].x < a[i].x) ie = i, je = j + 1;
+		else {
+			for (ie = i + 1; ie < i1 && a[ie].x == a[i].x; ++ie);
+			for (je = j + 1; je < j1 && b[je].x == b[j].x; ++je);
+		}
+		for (ii = i; ii < ie; ++ii)
+			for (jj = j; jj < je; ++jj)
+				if (m[jj] < 0 && b[jj].y == a[ii].y) {
+					m[jj] = ii, done[ii] = 1;
+					break;
+				}
+		for (ii = i; ii < ie; ++ii)
+			if (!done[ii] && (int32_t)a[ii].y < q_min) q_min = (int32_t)a[ii].y;
+		for (jj = j; jj < je; ++jj)
+			if (m[jj] < 0 && (int32_t)b[jj].y < q_min) q_min = (int32_t)b[jj].y;
+	}
+
+	// keep the anchors before all changes; p[] always points to an earlier anchor
+	for (jj = j0; jj < j1; ++jj) {
+		int32_t pj = inc->p[jj];
+		if ((ii = m[jj]) < 0) continue;
+		if ((int32_t)b[jj].y <= q_min && (pj < 0 || (m[pj] >= 0 && done[m[pj]])))
+			f[ii] = inc->f[jj], p[ii] = pj < 0? -1 : m[pj], v[ii] = inc->v[jj];
+		else done[ii] = 0;
+	}
+	kfree(km, m);
+}
+
+static void chain_inc_save(void *km, mm_chain_inc_t *inc, int max_dist_x, int max_dist_y, int64_t n, const mm128_t *a, const int32_t *f, const int32_t *p, const int32_t *v)
+{
+	if (n > inc->m) {
+		inc->m = n + (n>>1);
+		kfree(km, inc->a); kfree(km, inc->f); kfree(km, inc->p); kfree(km, inc->v);
+		inc->a = (mm128_t*)kmalloc(km, inc->m * sizeof(mm128_t));
+		inc->f = (int32_t*)kmalloc(km, inc->m * 4);
+		inc->p = (int32_t*)kmalloc(km, inc->m * 4);
+		inc->v = (int32_t*)kmalloc(km, inc->m * 4);
+	}
+	inc->n = n, inc->max_dist_x = max_dist_x, inc->max_dist_y = max_dist_y;
+	memcpy(inc->a, a, n * sizeof(mm128_t));
+	memcpy(inc->f, f, n * 4);
+	memcpy(inc->p, p, n * 4);
+	memcpy(inc->v, v, n * 4);
+}
+
+void mm_chain_inc_free(void *km, mm_chain_inc_t *inc)
+{
+	kfree(km, inc->a); kfree(km, inc->f); kfree(km, inc->p); kfree(km, inc->v);
+	inc->a = 0, inc->f = inc->p = inc->v = 0, inc->n = inc->m = 0;
+}
+
+mm128_t *mm_chain_dp_inc(int max_dist_x, int min_dist_x, int max_dist_y, int bw, int max_skip, int max_iter, int min_cnt, int min_sc, float gap_scale, int is_cdna, int n_segs, int64_t n, mm128_t *a, int *n_u_, uint64_t **_u, void *km, mm_chain_inc_t *inc)
 { // TODO: make sure this works when n has more than 32 bits
 	int32_t k, *f, *p, *t, *v, n_u, n_v;
 	int64_t i, j, st = 0;
 	uint64_t *u, *u2, sum_qspan = 0;
 	float avg_qspan;
 	mm128_t *b, *w;
+	uint8_t *done = 0;
 
 	if (_u) *_u = 0, *n_u_ = 0;
 	if (n == 0 || a == 0) {
@@ -41,6 +122,11 @@ mm128_t *mm_chain_dp(int max_dist_x, int min_dist_x, int max_dist_y, int bw, int
 	for (i = 0; i < n; ++i) sum_qspan += a[i].y>>32&0xff;
 	avg_qspan = (float)sum_qspan / n;
 
+	if (inc && inc->n > 0 && inc->max_dist_x == max_dist_x && inc->max_dist_y == max_dist_y) {
+		done = (uint8_t*)kcalloc(km, n, 1);
+		chain_inc_reuse(km, inc, n, a, f, p, v, done);
+	}
+
 	// fill the score and backtrack arrays
 	for (i = 0; i < n; ++i) {
 		uint64_t ri = a[i].x;
@@ -53,6 +139,7 @@ mm128_t *mm_chain_dp(int max_dist_x, int min_dist_x, int max_dist_y, int bw, int
 			//due to the change below, max_iter may not be enforced anymore
 			while (i - st > max_iter && ri > a[st].x + min_dist_x) ++st;
 		}
+		if (done && done[i]) continue;
 		for (j = i - 1; j >= st; --j) {
 			int64_t dr = ri - a[j].x;
 			int32_t dq = qi - (int32_t)a[j].y, dd, sc, log_dd, gap_cost;
@@ -88,6 +175,8 @@ mm128_t *mm_chain_dp(int max_dist_x, int min_dist_x, int max_dist_y, int bw, int
 		f[i] = max_f, p[i] = max_j;
 		v[i] = max_j >= 0 && v[max_j] > max_f? v[max_j] : max_f; // v[] keeps the peak score up to i; f[] is the score ending at i, not always the peak
 	}
+	kfree(km, done);
+	if (inc) chain_inc_save(km, inc, max_dist_x, max_dist_y, n, a, f, p, v);
 
 	// find the ending positions of chains
 	memset(t, 0, n * 4);
@@ -165,3 +254,8 @@ mm128_t *mm_chain_dp(int max_dist_x, int min_dist_x, int max_dist_y, int bw, int
 	kfree(km, a); kfree(km, w); kfree(km, u2);
 	return b;
 }
+
+mm128_t *mm_chain_dp(int max_dist_x, int min_dist_x, int max_dist_y, int bw, int max_skip, int max_iter, int min_cnt, int min_sc, float gap_scale, int is_cdna, int n_segs, int64_t n, mm128_t *a, int *n_u_, uint64_t **_u, void *km)
+{
+	return mm_chain_dp_inc(max_dist_x, min_dist_x, max_dist_y, bw, max_skip, max_iter, min_cnt, min_sc, gap_scale, is_cdna, n_segs, n, a, n_u_, _u, km, 0);
+}
@@ -4,9 +4,18 @@
 #include <io.h> // for open(2)
 #else
 #include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/statvfs.h>
 #endif
+#include <sys/stat.h>
 #include <fcntl.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include <stdio.h>
+#include <ctype.h>
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
 #define __STDC_LIMIT_MACROS
@@ -16,27 +25,244 @@
 #include "mmpriv.h"
 #include "kvec.h"
 #include "khash.h"
-#include <fstream>
-#include <iostream>
-#include <sstream>
-#include <limits>
-
-#define idx_hash(a) ((a)>>1)
-#define idx_eq(a, b) ((a)>>1 == (b)>>1)
-KHASH_INIT(idx, uint64_t, uint64_t, 1, idx_hash, idx_eq)
-typedef khash_t(idx) idxhash_t;
+#include "bloom.h"
+#include "kmerset.h"
 
 KHASH_MAP_INIT_STR(str, uint32_t)
 
 #define kroundup64(x) (--(x), (x)|=(x)>>1, (x)|=(x)>>2, (x)|=(x)>>4, (x)|=(x)>>8, (x)|=(x)>>16, (x)|=(x)>>32, ++(x))
 
 typedef struct mm_idx_bucket_s {
-	mm128_v a;   // (minimizer, position) array
+	mm128_v a;   // (minimizer, position) array; (key, value) pairs until the table is built
 	int32_t n;   // size of the _p_ array
 	uint64_t *p; // position array for minimizers appearing >1 times
-	void *h;     // hash table indexing _p_ and minimizers appearing once
+	uint32_t n_z; // size of the _z_ array in bytes
+	uint8_t *z;  // compressed position lists with MM_I_PACK_POS
+	uint32_t n_keys, n_lines; // number of distinct minimizers; size of _h_ in 64-byte lines
+	void *h;     // read-only table indexing _p_ and minimizers appearing once
 } mm_idx_bucket_t;
 
+/*
+ * Read-only minimizer table of a bucket, built once the bucket is complete.
+ * The key of minimizer x is (x>>b)<<1 with the lowest bit set if x occurs
+ * once; the value is then its position, and otherwise the offset of its
+ * positions in _p_ (high 32 bits) and their number (low 32 bits). Keys are
+ * linearly probed over 64-byte lines starting from a line proportional to
+ * the key, so a lookup usually reads a single cache line. Keys take 32 bits,
+ * five to a line, when the 2k-b bits of (x>>b) fit in 30 bits, or 64 bits,
+ * four to a line, otherwise. Empty slots have all key bits set. The tables
+ * of all buckets share one allocation, mm_idx_t::tab.
+ */
+
+#define MM_IDX_KEY32_BITS 30
+#define MM_IDX_LOAD       0.8 // maximum fraction of occupied slots
+
+typedef struct {
+	uint32_t key[5], dummy;
+	uint64_t val[5];
+} mm_idx_line32_t;
+
+typedef struct {
+	uint64_t key[4];
+	uint64_t val[4];
+} mm_idx_line64_t;
+
+static inline int idx_key_bits(const mm_idx_t *mi)
+{
+	return mi->k * 2 - mi->b;
+}
+
+static inline int idx_capped(const mm_idx_t *mi, uint64_t n) // whether the positions of a minimizer occurring $n times are dropped
+{
+	return mi->occ_cap > 0 && n >= (uint64_t)mi->occ_cap;
+}
+
+static inline uint32_t idx_home(uint64_t x, int key_bits, uint32_t n_lines) // x = minimizer>>b
+{
+	return (uint32_t)((unsigned __int128)x * n_lines >> key_bits);
+}
+
+// look up x = minimizer>>b; return the slot index or -1
+static inline int64_t idx_find32(const mm_idx_bucket_t *b, uint64_t x, int key_bits)
+{
+	const mm_idx_line32_t *t = (const mm_idx_line32_t*)b->h;
+	uint32_t l = idx_home(x, key_bits, b->n_lines);
+	for (;;) {
+		const mm_idx_line32_t *p = &t[l];
+		int j, hit = -1, empty = 0;
+		for (j = 0; j < 5; ++j) {
+			hit = p->key[j]>>1 == x? j : hit;
+			empty |= p->key[j] == UINT32_MAX;
+		}
+		if (hit >= 0) return (int64_t)l * 5 + hit;
+		if (empty) return -1;
+		l = l + 1 == b->n_lines? 0 : l + 1;
+	}
+}
+
+static inline int64_t idx_find64(const mm_idx_bucket_t *b, uint64_t x, int key_bits)
+{
+	const mm_idx_line64_t *t = (const mm_idx_line64_t*)b->h;
+	uint32_t l = idx_home(x, key_bits, b->n_lines);
+	for (;;) {
+		const mm_idx_line64_t *p = &t[l];
+		int j, hit = -1, empty = 0;
+		for (j = 0; j < 4; ++j) {
+			hit = p->key[j]>>1 == x? j : hit;
+			empty |= p->key[j] == UINT64_MAX;
+		}
+		if (hit >= 0) return (int64_t)l * 4 + hit;
+		if (empty) return -1;
+		l = l + 1 == b->n_lines? 0 : l + 1;
+	}
+}
+
+static inline uint64_t idx_n_slots(const mm_idx_t *mi, const mm_idx_bucket_t *b)
+{
+	return (uint64_t)b->n_lines * (idx_key_bits(mi) <= MM_IDX_KEY32_BITS? 5 : 4);
+}
+
+// get the key and value of slot $s; return 0 if the slot is empty
+static inline int idx_slot(const mm_idx_t *mi, const mm_idx_bucket_t *b, uint64_t s, uint64_t *key, uint64_t **val)
+{
+	if (idx_key_bits(mi) <= MM_IDX_KEY32_BITS) {
+		mm_idx_line32_t *p = &((mm_idx_line32_t*)b->h)[s / 5];
+		*key = p->key[s % 5], *val = &p->val[s % 5];
+		return *key != UINT32_MAX;
+	} else {
+		mm_idx_line64_t *p = &((mm_idx_line64_t*)b->h)[s / 4];
+		*key = p->key[s % 4], *val = &p->val[s % 4];
+		return *key != UINT64_MAX;
+	}
+}
+
+static inline uint32_t idx_n_lines(const mm_idx_t *mi, uint32_t n_keys)
+{
+	uint32_t cap = (uint32_t)((idx_key_bits(mi) <= MM_IDX_KEY32_BITS? 5 : 4) * MM_IDX_LOAD); // < slots per line, so one slot stays empty
+	return (n_keys + cap - 1) / cap;
+}
+
+static void idx_table_fill(const mm_idx_t *mi, mm_idx_bucket_t *b) // insert the pairs in b->a into b->h
+{
+	int key_bits = idx_key_bits(mi), is32 = key_bits <= MM_IDX_KEY32_BITS;
+	uint32_t i;
+	memset(b->h, 0xff, (size_t)b->n_lines * 64);
+	for (i = 0; i < b->n_keys; ++i) {
+		uint64_t key = b->a.a[i].x, val = b->a.a[i].y;
+		uint32_t l = idx_home(key>>1, key_bits, b->n_lines);
+		for (;; l = l + 1 == b->n_lines? 0 : l + 1) {
+			int j;
+			if (is32) {
+				mm_idx_line32_t *p = &((mm_idx_line32_t*)b->h)[l];
+				for (j = 0; j < 5 && p->key[j] != UINT32_MAX; ++j);
+				if (j == 5) continue;
+				p->key[j] = key, p->val[j] = val;
+			} else {
+				mm_idx_line64_t *p = &((mm_idx_line64_t*)b->h)[l];
+				for (j = 0; j < 4 && p->key[j] != UINT64_MAX; ++j);
+				if (j == 4) continue;
+				p->key[j] = key, p->val[j] = val;
+			}
+			break;
+		}
+	}
+}
+
+/*
+ * Compressed position lists (MM_I_PACK_POS). The positions of a minimizer
+ * occurring MM_IDX_PACK_MIN or more times are kept in _z_ instead of _p_,
+ * and its table value holds their byte offset in _z_ rather than in _p_.
+ * The sorted list is cut into blocks of MM_IDX_PACK_BLOCK positions. For
+ * each position a block stores how much the reference ID increases and
+ * the (pos<<1|strand) field, as a difference if the ID is unchanged and
+ * as is otherwise. A block is the bit widths of these two fields in two
+ * bytes, followed by the ID increases and then the position fields, all
+ * packed at their widths. _z_ ends with MM_IDX_PACK_PAD zero bytes so
+ * that every field can be read with one unaligned 64-bit load.
+ */
+
+#define MM_IDX_PACK_MIN   16
+#define MM_IDX_PACK_BLOCK 32
+#define MM_IDX_PACK_PAD   8
+
+typedef struct { size_t n, m; uint8_t *a; } uint8_v;
+
+static inline uint32_t idx_bits_get(const uint8_t *p, uint64_t o, int w) // $w <= 32 bits at bit offset $o
+{
+	uint64_t x;
+	memcpy(&x, p + (o>>3), 8);
+	return x >> (o&7) & ((1ULL<<w) - 1);
+}
+
+static inline void idx_bits_put(uint8_t *p, uint64_t o, uint32_t x) // OR $x in at bit offset $o
+{
+	uint64_t y;
+	memcpy(&y, p + (o>>3), 8);
+	y |= (uint64_t)x << (o&7);
+	memcpy(p + (o>>3), &y, 8);
+}
+
+static inline int idx_bit_width(uint32_t x)
+{
+	return x? 32 - __builtin_clz(x) : 0;
+}
+
+static inline uint64_t idx_pack_block_len(int n, int wr, int wp)
+{
+	return 2 + ((uint64_t)n * (wr + wp) + 7) / 8;
+}
+
+static void idx_pack_pos(uint8_v *z, int n, const uint64_t *a) // append the $n sorted positions $a to $z
+{
+	uint32_t dr[MM_IDX_PACK_BLOCK], dp[MM_IDX_PACK_BLOCK];
+	uint64_t prev = 0;
+	int i, j;
+	for (i = 0; i < n; i += MM_IDX_PACK_BLOCK) {
+		int m = n - i < MM_IDX_PACK_BLOCK? n - i : MM_IDX_PACK_BLOCK, wr, wp;
+		uint32_t or_r = 0, or_p = 0;
+		uint64_t o, len;
+		uint8_t *p;
+		for (j = 0; j < m; ++j) {
+			uint64_t x = a[i + j];
+			dr[j] = (x>>32) - (prev>>32);
+			dp[j] = dr[j]? (uint32_t)x : (uint32_t)x - (uint32_t)prev;
+			or_r |= dr[j], or_p |= dp[j];
+			prev = x;
+		}
+		wr = idx_bit_width(or_r), wp = idx_bit_width(or_p);
+		len = idx_pack_block_len(m, wr, wp);
+		kv_resize(uint8_t, 0, *z, z->n + len + MM_IDX_PACK_PAD);
+		p = z->a + z->n;
+		memset(p, 0, len + MM_IDX_PACK_PAD);
+		p[0] = wr, p[1] = wp;
+		for (j = 0, o = 16; j < m; ++j, o += wr)
+			idx_bits_put(p, o, dr[j]);
+		for (j = 0; j < m; ++j, o += wp)
+			idx_bits_put(p, o, dp[j]);
+		z->n += len;
+	}
+}
+
+void mm_idx_unpack_pos(const uint8_t *z, int n, uint64_t *a)
+{
+	uint64_t rid = 0;
+	uint32_t pos = 0;
+	int i, j;
+	for (i = 0; i < n; i += MM_IDX_PACK_BLOCK) {
+		int m = n - i < MM_IDX_PACK_BLOCK? n - i : MM_IDX_PACK_BLOCK, wr = z[0], wp = z[1];
+		uint64_t o = 16;
+		for (j = 0; j < m; ++j, o += wr)
+			a[i + j] = idx_bits_get(z, o, wr);
+		for (j = 0; j < m; ++j, o += wp) {
+			uint32_t x = idx_bits_get(z, o, wp);
+			rid += a[i + j];
+			pos = a[i + j]? x : pos + x;
+			a[i + j] = rid<<32 | pos;
+		}
+		z += idx_pack_block_len(m, wr, wp);
+	}
+}
+
 typedef struct {
 	int32_t st, en, max; // max is not used for now
 	int32_t score:30, strand:2;
@@ -59,6 +285,70 @@ mm_idx_t *mm_idx_init(int w, int k, int b, int flag)
 	return mi;
 }
 
+static void idx_unmap(void *map, uint64_t map_len)
+{
+#ifdef WIN32
+	free(map);
+#else
+	munmap(map, map_len);
+#endif
+}
+
+/*
+ * Index in shared memory (--idx-shm). The first process to ask for a name
+ * creates the segment, reads or builds the index as usual and copies its
+ * memory-mappable image (see mm_idx_dump_mmap()) into the segment after a
+ * small header; later processes map it read-only and use it in place. A name
+ * containing a '/' past its first character is a file path instead, e.g. on
+ * hugetlbfs. Every process using the segment holds a shared flock() on it,
+ * and the publisher an exclusive one until the image is complete. The last
+ * process to release its lock removes the segment, so no process keeps a
+ * reference count that a crash could leave wrong. The header records the
+ * input file and indexing options of the publisher; a job asking for another
+ * file, or building from sequences with other options, is refused.
+ */
+
+typedef struct {
+	char magic[4];       // MM_IDX_MAGIC_MMAP, written once the image is complete
+	uint32_t dummy;
+	uint64_t len;        // size of the image, which starts at offset MM_IDX_MAP_ALIGN
+	uint64_t target[4];  // mm_idx_reader_t::target of the publisher
+	short k, w, flag, dummy2; // indexing options of the publisher, without MM_I_MMAP and MM_I_POPULATE
+	int32_t occ_cap;
+} mm_idx_shm_hdr_t;
+
+#ifndef WIN32
+static inline int idx_shm_is_path(const char *name)
+{
+	return strchr(name + 1, '/') != 0;
+}
+
+static int idx_shm_open(const char *name, int flags)
+{
+	return idx_shm_is_path(name)? open(name, flags, 0644) : shm_open(name, flags, 0644);
+}
+
+static void idx_shm_unlink(const char *name)
+{
+	if (idx_shm_is_path(name)) unlink(name);
+	else shm_unlink(name);
+}
+
+static void idx_shm_detach(mm_idx_t *mi)
+{
+	flock(mi->shm_fd, LOCK_UN);
+	if (flock(mi->shm_fd, LOCK_EX|LOCK_NB) == 0) { // the last user
+		idx_shm_unlink(mi->shm_name);
+		if (mm_verbose >= 3)
+			fprintf(stderr, "[M::%s::%.3f*%.2f] removed the index '%s'\n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), mi->shm_name);
+	}
+	close(mi->shm_fd);
+	free(mi->shm_name);
+}
+#else
+static void idx_shm_detach(mm_idx_t *mi) {}
+#endif
+
 void mm_idx_destroy(mm_idx_t *mi)
 {
 	uint32_t i;
@@ -66,9 +356,9 @@ void mm_idx_destroy(mm_idx_t *mi)
 	if (mi->h) kh_destroy(str, (khash_t(str)*)mi->h);
 	if (mi->B) {
 		for (i = 0; i < 1U<<mi->b; ++i) {
-			free(mi->B[i].p);
+			if (mi->map) continue; // the positions and tables live in the mapped image
+			free(mi->B[i].p); free(mi->B[i].z);
 			free(mi->B[i].a.a);
-			kh_destroy(idx, (idxhash_t*)mi->B[i].h);
 		}
 	}
 	if (mi->I) {
@@ -77,56 +367,75 @@ void mm_idx_destroy(mm_idx_t *mi)
 		free(mi->I);
 	}
 	if (!mi->km) {
-		for (i = 0; i < mi->n_seq; ++i)
+		for (i = 0; i < mi->n_seq && !mi->map; ++i)
 			free(mi->seq[i].name);
 		free(mi->seq);
 	} else km_destroy(mi->km);
-	delete mi->downFilter;
-	free(mi->B); free(mi->S); free(mi);
+	mm_bloom_destroy(mi->downFilter); // mm_bloom_t::mem is 0 when mapped
+	if (mi->map) {
+		free(mi->downSet);
+		idx_unmap(mi->map, mi->map_len);
+		if (mi->shm_name) idx_shm_detach(mi);
+	} else {
+		mm_kset_destroy(mi->downSet);
+		free(mi->S); free(mi->amb); free(mi->occ);
+	}
+	free(mi->tab); free(mi->B); free(mi);
 }
 
-const uint64_t *mm_idx_get(const mm_idx_t *mi, uint64_t minier, int *n)
+const uint64_t *mm_idx_get(const mm_idx_t *mi, uint64_t minier, int *n, const uint8_t **z)
 {
-	int mask = (1<<mi->b) - 1;
-	khint_t k;
+	int mask = (1<<mi->b) - 1, key_bits = idx_key_bits(mi);
 	mm_idx_bucket_t *b = &mi->B[minier&mask];
-	idxhash_t *h = (idxhash_t*)b->h;
-	*n = 0;
-	if (h == 0) return 0;
-	k = kh_get(idx, h, minier>>mi->b<<1);
-	if (k == kh_end(h)) return 0;
-	if (kh_key(h, k)&1) { // special casing when there is only one k-mer
+	uint64_t key, *val;
+	int64_t s;
+	*n = 0, *z = 0;
+	if (b->h == 0) return 0;
+	s = key_bits <= MM_IDX_KEY32_BITS? idx_find32(b, minier>>mi->b, key_bits) : idx_find64(b, minier>>mi->b, key_bits);
+	if (s < 0) return 0;
+	idx_slot(mi, b, s, &key, &val);
+	if (key&1) { // special casing when there is only one k-mer
 		*n = 1;
-		return &kh_val(h, k);
+		return val;
 	} else {
-		*n = (uint32_t)kh_val(h, k);
-		return &b->p[kh_val(h, k)>>32];
+		*n = (uint32_t)*val;
+		if (idx_capped(mi, *n)) return 0; // the positions were dropped at build time
+		if ((mi->flag & MM_I_PACK_POS) && *n >= MM_IDX_PACK_MIN) {
+			*z = &b->z[*val>>32];
+			return 0;
+		}
+		return &b->p[*val>>32];
+	}
+}
+
+void mm_idx_get_batch(const mm_idx_t *mi, int n, const uint64_t *minier, int *cnt, const uint64_t **cr, const uint8_t **z)
+{
+	int i, mask = (1<<mi->b) - 1, key_bits = idx_key_bits(mi);
+	for (i = 0; i < n; ++i) // the bucket records
+		__builtin_prefetch(&mi->B[minier[i]&mask]);
+	for (i = 0; i < n; ++i) { // then the home lines of the tables, where a lookup almost always ends
+		const mm_idx_bucket_t *b = &mi->B[minier[i]&mask];
+		if (b->h) __builtin_prefetch((const uint8_t*)b->h + (size_t)idx_home(minier[i]>>mi->b, key_bits, b->n_lines) * 64);
+	}
+	for (i = 0; i < n; ++i) { // resolve them, and start loading the positions
+		cr[i] = mm_idx_get(mi, minier[i], &cnt[i], &z[i]);
+		if (cnt[i] > 1) __builtin_prefetch(cr[i]? (const void*)cr[i] : (const void*)z[i]);
 	}
 }
 
 void mm_idx_stat(const mm_idx_t *mi)
 {
-	int n = 0, n1 = 0;
-	uint32_t i;
-	uint64_t sum = 0, len = 0;
+	uint64_t i, n = 0, n1 = 0, sum = 0, len = 0;
 	fprintf(stderr, "[M::%s] kmer size: %d; skip: %d; is_hpc: %d; #seq: %d\n", __func__, mi->k, mi->w, mi->flag&MM_I_HPC, mi->n_seq);
 	if (mi->w < 25) //display a warning if user adjusted window size is too low
 		fprintf(stderr, "[M::%s] warning: setting a lower window size (-w) can increase runtime and memory\n", __func__);
 	for (i = 0; i < mi->n_seq; ++i)
 		len += mi->seq[i].len;
-	for (i = 0; i < 1U<<mi->b; ++i)
-		if (mi->B[i].h) n += kh_size((idxhash_t*)mi->B[i].h);
-	for (i = 0; i < 1U<<mi->b; ++i) {
-		idxhash_t *h = (idxhash_t*)mi->B[i].h;
-		khint_t k;
-		if (h == 0) continue;
-		for (k = 0; k < kh_end(h); ++k)
-			if (kh_exist(h, k)) {
-				sum += kh_key(h, k)&1? 1 : (uint32_t)kh_val(h, k);
-				if (kh_key(h, k)&1) ++n1;
-			}
+	for (i = 0; i < mi->n_occ; ++i) {
+		n += mi->occ[i<<1|1], sum += mi->occ[i<<1] * mi->occ[i<<1|1];
+		if (mi->occ[i<<1] == 1) n1 = mi->occ[i<<1|1];
 	}
-	fprintf(stderr, "[M::%s::%.3f*%.2f] distinct minimizers: %d (%.2f%% are singletons); average occurrences: %.3lf; average spacing: %.3lf\n",
+	fprintf(stderr, "[M::%s::%.3f*%.2f] distinct minimizers: %" PRIu64 " (%.2f%% are singletons); average occurrences: %.3lf; average spacing: %.3lf\n",
 			__func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), n, 100.0*n1/n, (double)sum / n, (double)len / sum);
 }
 
@@ -158,6 +467,50 @@ int mm_idx_name2id(const mm_idx_t *mi, const char *name)
 	return k == kh_end(h)? -1 : kh_val(h, k);
 }
 
+static inline uint64_t idx_S_words(const mm_idx_t *mi, uint64_t len) // number of 32-bit words of S holding $len bases
+{
+	return mi->flag & MM_I_2BIT? (len + 15) / 16 : (len + 7) / 8;
+}
+
+static uint64_t idx_amb_lower(const mm_idx_t *mi, uint64_t o) // index of the first ambiguous run ending after $o
+{
+	uint64_t lo = 0, hi = mi->n_amb;
+	while (lo < hi) {
+		uint64_t mid = (lo + hi) >> 1;
+		if (mi->amb[mid<<1|1] <= o) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+int mm_idx_is_amb(const mm_idx_t *mi, uint64_t o)
+{
+	uint64_t i = idx_amb_lower(mi, o);
+	return i < mi->n_amb && mi->amb[i<<1] <= o;
+}
+
+static void idx_unpack_seq2(const uint32_t *S, uint64_t st, uint64_t en, uint8_t *seq) // 2-bit codes of bases [st,en)
+{
+	uint64_t i = st;
+	for (; i < en && i & 15; ++i)
+		seq[i - st] = mm_seq2_get(S, i);
+#ifdef __SSE2__
+	{
+		const __m128i lo = _mm_set1_epi32(0x40100401), hi = _mm_set1_epi32((int)0x80200802); // the two bits of each base
+		for (; i + 16 <= en; i += 16) {
+			__m128i x = _mm_cvtsi32_si128(S[i>>4]);
+			x = _mm_unpacklo_epi8(x, x);
+			x = _mm_unpacklo_epi16(x, x); // byte j now holds the four bases including base j
+			x = _mm_or_si128(_mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(x, lo), lo), _mm_set1_epi8(1)),
+							 _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(x, hi), hi), _mm_set1_epi8(2)));
+			_mm_storeu_si128((__m128i*)(seq + (i - st)), x);
+		}
+	}
+#endif
+	for (; i < en; ++i)
+		seq[i - st] = mm_seq2_get(S, i);
+}
+
 int mm_idx_getseq(const mm_idx_t *mi, uint32_t rid, uint32_t st, uint32_t en, uint8_t *seq)
 {
 	uint64_t i, st1, en1;
@@ -165,45 +518,58 @@ int mm_idx_getseq(const mm_idx_t *mi, uint32_t rid, uint32_t st, uint32_t en, ui
 	if (en > mi->seq[rid].len) en = mi->seq[rid].len;
 	st1 = mi->seq[rid].offset + st;
 	en1 = mi->seq[rid].offset + en;
-	for (i = st1; i < en1; ++i)
-		seq[i - st1] = mm_seq4_get(mi->S, i);
+	if (mi->flag & MM_I_2BIT) {
+		idx_unpack_seq2(mi->S, st1, en1, seq);
+		for (i = idx_amb_lower(mi, st1); i < mi->n_amb && mi->amb[i<<1] < en1; ++i) {
+			uint64_t s = mi->amb[i<<1] > st1? mi->amb[i<<1] : st1, e = mi->amb[i<<1|1] < en1? mi->amb[i<<1|1] : en1;
+			memset(&seq[s - st1], 4, e - s);
+		}
+	} else {
+		for (i = st1; i < en1; ++i)
+			seq[i - st1] = mm_seq4_get(mi->S, i);
+	}
 	return en - st;
 }
 
 int32_t mm_idx_cal_max_occ(const mm_idx_t *mi, float f)
 {
-	int i;
-	size_t n = 0;
-	uint32_t thres;
-	khint_t *a, k;
+	uint64_t i, n = 0, kk;
 	if (f <= 0.) return INT32_MAX;
-	for (i = 0; i < 1<<mi->b; ++i)
-		if (mi->B[i].h) n += kh_size((idxhash_t*)mi->B[i].h);
-	a = (uint32_t*)malloc(n * 4);
-	for (i = n = 0; i < 1<<mi->b; ++i) {
-		idxhash_t *h = (idxhash_t*)mi->B[i].h;
-		if (h == 0) continue;
-		for (k = 0; k < kh_end(h); ++k) {
-			if (!kh_exist(h, k)) continue;
-			a[n++] = kh_key(h, k)&1? 1 : (uint32_t)kh_val(h, k);
-		}
+	for (i = 0; i < mi->n_occ; ++i)
+		n += mi->occ[i<<1|1];
+	kk = (uint32_t)((1. - f) * n); // the rank of the threshold among the occurrences of all distinct minimizers
+	for (i = 0; i < mi->n_occ; ++i) {
+		if (kk < mi->occ[i<<1|1]) return mi->occ[i<<1] + 1;
+		kk -= mi->occ[i<<1|1];
 	}
-	thres = ks_ksmall_uint32_t(n, a, (uint32_t)((1. - f) * n)) + 1;
-	free(a);
-	return thres;
+	return INT32_MAX;
 }
 
 /*********************************
  * Sort and generate hash tables *
  *********************************/
 
+#define MM_IDX_OCC_DENSE 1024 // occurrences below this are counted in an array; the rest are listed
+
+typedef struct { size_t n, m; uint64_t *a; } uint64_v;
+
+typedef struct {
+	mm_idx_t *mi;
+	uint64_t *cnt; // cnt[tid*MM_IDX_OCC_DENSE + occ]: number of minimizers occurring occ times
+	uint64_v *big; // big[tid]: occurrences of MM_IDX_OCC_DENSE or more
+	uint64_v *buf; // buf[tid]: a position list being compressed
+} post_shared_t;
+
 static void worker_post(void *g, long i, int tid)
 {
 	int n, n_keys;
 	size_t j, start_a, start_p;
-	idxhash_t *h;
-	mm_idx_t *mi = (mm_idx_t*)g;
+	post_shared_t *d = (post_shared_t*)g;
+	mm_idx_t *mi = d->mi;
 	mm_idx_bucket_t *b = &mi->B[i];
+	uint64_t *cnt = &d->cnt[(size_t)tid * MM_IDX_OCC_DENSE];
+	uint8_v z = {0,0,0};
+	int pack = !!(mi->flag & MM_I_PACK_POS);
 	if (b->a.n == 0) return;
 
 	// sort by minimizer
@@ -213,47 +579,282 @@ static void worker_post(void *g, long i, int tid)
 	for (j = 1, n = 1, n_keys = 0, b->n = 0; j <= b->a.n; ++j) {
 		if (j == b->a.n || b->a.a[j].x>>8 != b->a.a[j-1].x>>8) {
 			++n_keys;
-			if (n > 1) b->n += n;
+			if (n > 1 && !(pack && n >= MM_IDX_PACK_MIN) && !idx_capped(mi, n)) b->n += n;
+			if (n < MM_IDX_OCC_DENSE) ++cnt[n];
+			else kv_push(uint64_t, 0, d->big[tid], n);
 			n = 1;
 		} else ++n;
 	}
-	h = kh_init(idx);
-	kh_resize(idx, h, n_keys);
 	b->p = (uint64_t*)calloc(b->n, 8);
 
-	// create the hash table
-	for (j = 1, n = 1, start_a = start_p = 0; j <= b->a.n; ++j) {
+	// turn b->a into (key, value) pairs in place, in the order of minimizers
+	for (j = 1, n = 1, start_a = start_p = 0, n_keys = 0; j <= b->a.n; ++j) {
 		if (j == b->a.n || b->a.a[j].x>>8 != b->a.a[j-1].x>>8) {
-			khint_t itr;
-			int absent;
-			mm128_t *p = &b->a.a[j-1];
-			itr = kh_put(idx, h, p->x>>8>>mi->b<<1, &absent);
-			assert(absent && j == start_a + n);
+			mm128_t *p = &b->a.a[j-1], kv;
+			assert(j == start_a + n);
+			kv.x = p->x>>8>>mi->b<<1;
 			if (n == 1) {
-				kh_key(h, itr) |= 1;
-				kh_val(h, itr) = p->y;
+				kv.x |= 1;
+				kv.y = p->y;
+			} else if (idx_capped(mi, n)) { // keep the count only
+				kv.y = n;
+			} else if (pack && n >= MM_IDX_PACK_MIN) {
+				int k;
+				kv_resize(uint64_t, 0, d->buf[tid], (size_t)n);
+				for (k = 0; k < n; ++k)
+					d->buf[tid].a[k] = b->a.a[start_a + k].y;
+				radix_sort_64(d->buf[tid].a, d->buf[tid].a + n);
+				assert(z.n < 1ULL<<32);
+				kv.y = (uint64_t)z.n<<32 | n;
+				idx_pack_pos(&z, n, d->buf[tid].a);
 			} else {
 				int k;
 				for (k = 0; k < n; ++k)
 					b->p[start_p + k] = b->a.a[start_a + k].y;
 				radix_sort_64(&b->p[start_p], &b->p[start_p + n]); // sort by position; needed as in-place radix_sort_128x() is not stable
-				kh_val(h, itr) = (uint64_t)start_p<<32 | n;
+				kv.y = (uint64_t)start_p<<32 | n;
 				start_p += n;
 			}
+			b->a.a[n_keys++] = kv; // n_keys <= start_a, so the unread part of b->a is intact
 			start_a = j, n = 1;
 		} else ++n;
 	}
-	b->h = h;
 	assert(b->n == (int32_t)start_p);
+	b->n_keys = b->a.n = n_keys;
+	if (z.n > 0) b->z = z.a, b->n_z = z.n + MM_IDX_PACK_PAD; // the padding is already zeroed
+}
 
-	// deallocate and clear b->a
+static void worker_post_table(void *g, long i, int tid)
+{
+	mm_idx_t *mi = (mm_idx_t*)g;
+	mm_idx_bucket_t *b = &mi->B[i];
+	if (b->n_keys == 0) return;
+	idx_table_fill(mi, b);
 	kfree(0, b->a.a);
 	b->a.n = b->a.m = 0, b->a.a = 0;
 }
- 
+
+static void mm_idx_post_table(mm_idx_t *mi, int n_threads) // build the tables from the pairs in B[i].a
+{
+	uint64_t i, n_lines = 0;
+	uint8_t *t;
+	for (i = 0; i < 1ULL<<mi->b; ++i) {
+		mi->B[i].n_lines = mi->B[i].n_keys? idx_n_lines(mi, mi->B[i].n_keys) : 0;
+		n_lines += mi->B[i].n_lines;
+	}
+	mi->tab = malloc(n_lines * 64 + 64);
+	t = (uint8_t*)(((uintptr_t)mi->tab + 63) & ~(uintptr_t)63);
+	for (i = 0; i < 1ULL<<mi->b; ++i) {
+		mi->B[i].h = mi->B[i].n_lines? t : 0;
+		t += (uint64_t)mi->B[i].n_lines * 64;
+	}
+	kt_for(n_threads, worker_post_table, mi, 1<<mi->b);
+}
+
 static void mm_idx_post(mm_idx_t *mi, int n_threads)
 {
-	kt_for(n_threads, worker_post, mi, 1<<mi->b);
+	post_shared_t d;
+	uint64_v occ = {0,0,0};
+	uint64_t c, j;
+	int t;
+	d.mi = mi;
+	d.cnt = (uint64_t*)calloc((size_t)n_threads * MM_IDX_OCC_DENSE, 8);
+	d.big = (uint64_v*)calloc(n_threads, sizeof(uint64_v));
+	d.buf = (uint64_v*)calloc(n_threads, sizeof(uint64_v));
+	kt_for(n_threads, worker_post, &d, 1<<mi->b);
+	for (t = 0; t < n_threads; ++t)
+		kfree(0, d.buf[t].a);
+	free(d.buf);
+	for (j = 1; j < MM_IDX_OCC_DENSE; ++j) { // merge the per-thread counts into the histogram
+		for (t = 0, c = 0; t < n_threads; ++t)
+			c += d.cnt[(size_t)t * MM_IDX_OCC_DENSE + j];
+		if (c == 0) continue;
+		kv_push(uint64_t, 0, occ, j);
+		kv_push(uint64_t, 0, occ, c);
+	}
+	for (t = 1; t < n_threads; ++t) { // then the rare large occurrences, sorted
+		for (j = 0; j < d.big[t].n; ++j)
+			kv_push(uint64_t, 0, d.big[0], d.big[t].a[j]);
+		kfree(0, d.big[t].a);
+	}
+	radix_sort_64(d.big[0].a, d.big[0].a + d.big[0].n);
+	for (j = 0; j < d.big[0].n; ++j) {
+		if (j > 0 && d.big[0].a[j] == d.big[0].a[j-1]) {
+			++occ.a[occ.n - 1];
+		} else {
+			kv_push(uint64_t, 0, occ, d.big[0].a[j]);
+			kv_push(uint64_t, 0, occ, 1);
+		}
+	}
+	kfree(0, d.big[0].a);
+	free(d.big); free(d.cnt);
+	mi->n_occ = occ.n / 2, mi->occ = occ.a;
+	if (mi->occ_cap > 0 && mm_verbose >= 3) {
+		uint64_t n_cap = 0, n_pos = 0;
+		for (j = 0; j < mi->n_occ; ++j)
+			if (idx_capped(mi, mi->occ[j<<1]))
+				n_cap += mi->occ[j<<1|1], n_pos += mi->occ[j<<1] * mi->occ[j<<1|1];
+		fprintf(stderr, "[M::%s::%.3f*%.2f] dropped %" PRIu64 " positions of %" PRIu64 " minimizers occurring %d or more times\n", __func__,
+				realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), n_pos, n_cap, mi->occ_cap);
+	}
+	if ((mi->flag & MM_I_PACK_POS) && mm_verbose >= 3) {
+		uint64_t n_pos = 0, n_z = 0;
+		for (j = 0; j < mi->n_occ; ++j)
+			if (mi->occ[j<<1] >= MM_IDX_PACK_MIN && !idx_capped(mi, mi->occ[j<<1]))
+				n_pos += mi->occ[j<<1] * mi->occ[j<<1|1];
+		for (j = 0; j < 1ULL<<mi->b; ++j)
+			n_z += mi->B[j].n_z;
+		fprintf(stderr, "[M::%s::%.3f*%.2f] compressed %" PRIu64 " positions of repetitive minimizers from %.2f to %.2f MB\n", __func__,
+				realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), n_pos, n_pos * 8.0 / 1048576, n_z / 1048576.0);
+	}
+	mm_idx_post_table(mi, n_threads);
+}
+
+/*************************
+ * Pack sequences into S *
+ *************************/
+
+#define MM_IDX_PACK_CHUNK 0x100000 // bases per packing job; a multiple of 16 so that no two jobs share a word of S
+
+#ifdef __SSE2__
+static inline __m128i idx_nt4_sse2(__m128i x) // the same as seq_nt4_table[] on 16 bytes
+{
+	__m128i u = _mm_and_si128(x, _mm_set1_epi8((char)0xDF)); // fold to upper case
+	__m128i a = _mm_cmpeq_epi8(u, _mm_set1_epi8('A'));
+	__m128i c = _mm_cmpeq_epi8(u, _mm_set1_epi8('C'));
+	__m128i g = _mm_cmpeq_epi8(u, _mm_set1_epi8('G'));
+	__m128i t = _mm_or_si128(_mm_cmpeq_epi8(u, _mm_set1_epi8('T')), _mm_cmpeq_epi8(u, _mm_set1_epi8('U')));
+	__m128i r = _mm_cmpeq_epi8(_mm_and_si128(x, _mm_set1_epi8((char)0xFC)), _mm_setzero_si128()); // already encoded as 0-3
+	__m128i z, hit = _mm_or_si128(_mm_or_si128(a, c), _mm_or_si128(_mm_or_si128(g, t), r));
+	z = _mm_or_si128(_mm_and_si128(c, _mm_set1_epi8(1)), _mm_and_si128(g, _mm_set1_epi8(2)));
+	z = _mm_or_si128(z, _mm_or_si128(_mm_and_si128(t, _mm_set1_epi8(3)), _mm_and_si128(r, x)));
+	return _mm_or_si128(z, _mm_andnot_si128(hit, _mm_set1_epi8(4)));
+}
+#endif
+
+// pack $len bases of $seq into $S starting from base $o; words only partially covered are OR'ed
+static void idx_pack_seq4(uint32_t *S, uint64_t o, const char *seq, uint64_t len)
+{
+	uint64_t i = 0;
+	for (; i < len && (o + i) & 7; ++i)
+		mm_seq4_set(S, o + i, seq_nt4_table[(uint8_t)seq[i]]);
+#ifdef __SSE2__
+	for (; i + 16 <= len; i += 16) {
+		__m128i x = idx_nt4_sse2(_mm_loadu_si128((const __m128i*)(seq + i)));
+		x = _mm_or_si128(_mm_and_si128(x, _mm_set1_epi16(0xff)), _mm_srli_epi16(x, 4)); // two bases per byte
+		_mm_storel_epi64((__m128i*)&S[(o + i) >> 3], _mm_packus_epi16(x, x));
+	}
+#endif
+	for (; i + 8 <= len; i += 8) {
+		uint32_t j, x = 0;
+		for (j = 0; j < 8; ++j)
+			x |= (uint32_t)seq_nt4_table[(uint8_t)seq[i + j]] << (j << 2);
+		S[(o + i) >> 3] = x;
+	}
+	for (; i < len; ++i)
+		mm_seq4_set(S, o + i, seq_nt4_table[(uint8_t)seq[i]]);
+}
+
+static inline void idx_amb_add(uint64_v *v, uint64_t st, uint64_t en) // append [st,en), merging with an adjacent run
+{
+	if (v->n > 0 && v->a[v->n - 1] == st) {
+		v->a[v->n - 1] = en;
+	} else {
+		kv_push(uint64_t, 0, *v, st);
+		kv_push(uint64_t, 0, *v, en);
+	}
+}
+
+// like idx_pack_seq4() with 2-bit codes; ambiguous bases are stored as A and appended to $amb
+static void idx_pack_seq2(uint32_t *S, uint64_t o, const char *seq, uint64_t len, uint64_v *amb)
+{
+	uint64_t i = 0;
+	int c, j;
+	for (; i < len && (o + i) & 15; ++i)
+		if ((c = seq_nt4_table[(uint8_t)seq[i]]) < 4) mm_seq2_set(S, o + i, c);
+		else idx_amb_add(amb, o + i, o + i + 1);
+#ifdef __SSE2__
+	for (; i + 16 <= len; i += 16) {
+		__m128i x = idx_nt4_sse2(_mm_loadu_si128((const __m128i*)(seq + i)));
+		int m = _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8(4)));
+		x = _mm_and_si128(x, _mm_set1_epi8(3));
+		x = _mm_or_si128(_mm_and_si128(x, _mm_set1_epi16(0xff)), _mm_srli_epi16(x, 6));    // two bases per 16 bits
+		x = _mm_or_si128(_mm_and_si128(x, _mm_set1_epi32(0xffff)), _mm_srli_epi32(x, 12)); // four bases per 32 bits
+		x = _mm_packs_epi32(x, x);
+		S[(o + i) >> 4] = _mm_cvtsi128_si32(_mm_packus_epi16(x, x));
+		if (m == 0xffff) idx_amb_add(amb, o + i, o + i + 16);
+		else if (m)
+			for (j = 0; j < 16; ++j)
+				if (m>>j&1) idx_amb_add(amb, o + i + j, o + i + j + 1);
+	}
+#endif
+	for (; i + 16 <= len; i += 16) {
+		uint32_t x = 0;
+		for (j = 0; j < 16; ++j) {
+			if ((c = seq_nt4_table[(uint8_t)seq[i + j]]) < 4) x |= (uint32_t)c << (j << 1);
+			else idx_amb_add(amb, o + i + j, o + i + j + 1);
+		}
+		S[(o + i) >> 4] = x;
+	}
+	for (; i < len; ++i)
+		if ((c = seq_nt4_table[(uint8_t)seq[i]]) < 4) mm_seq2_set(S, o + i, c);
+		else idx_amb_add(amb, o + i, o + i + 1);
+}
+
+typedef struct {
+	uint32_t *S;
+	uint64_t o0, *off; // $off[i] is the offset of seq[i] relative to $o0
+	int n_seq;
+	const mm_bseq1_t *seq;
+	uint64_v *amb;     // ambiguous bases found by each job if S is 2-bit; NULL for 4-bit
+} pack_shared_t;
+
+static void worker_pack(void *data, long c, int tid)
+{
+	pack_shared_t *d = (pack_shared_t*)data;
+	uint64_t st = (d->o0 & ~15ULL) + (uint64_t)c * MM_IDX_PACK_CHUNK, en = st + MM_IDX_PACK_CHUNK;
+	int i, lo = 0, hi = d->n_seq;
+	if (st < d->o0) st = d->o0;
+	if (en > d->o0 + d->off[d->n_seq]) en = d->o0 + d->off[d->n_seq];
+	while (lo < hi) { // find the last sequence starting at or before $st
+		int mid = (lo + hi + 1) >> 1;
+		if (d->off[mid] <= st - d->o0) lo = mid;
+		else hi = mid - 1;
+	}
+	for (i = lo; st < en; ++i) {
+		uint64_t l = d->o0 + d->off[i+1] < en? d->o0 + d->off[i+1] - st : en - st;
+		if (d->amb) idx_pack_seq2(d->S, st, d->seq[i].seq + (st - d->o0 - d->off[i]), l, &d->amb[c]);
+		else idx_pack_seq4(d->S, st, d->seq[i].seq + (st - d->o0 - d->off[i]), l);
+		st += l;
+	}
+}
+
+/**
+ * Pack a batch of sequences starting at base $o0 of $S; $S must have been zeroed from $o0 onwards
+ *
+ * @param amb    if not NULL, pack 2-bit codes and append runs of ambiguous bases to $amb
+ */
+static void idx_pack_batch(uint32_t *S, uint64_t o0, int n_seq, const mm_bseq1_t *seq, int n_threads, uint64_v *amb)
+{
+	pack_shared_t d;
+	uint64_t n_chunks, c, j;
+	int i;
+	d.S = S, d.o0 = o0, d.n_seq = n_seq, d.seq = seq;
+	d.off = (uint64_t*)malloc((n_seq + 1) * sizeof(uint64_t));
+	for (i = 0, d.off[0] = 0; i < n_seq; ++i)
+		d.off[i+1] = d.off[i] + seq[i].l_seq;
+	n_chunks = (o0 + d.off[n_seq] - (o0 & ~15ULL) + MM_IDX_PACK_CHUNK - 1) / MM_IDX_PACK_CHUNK;
+	d.amb = amb && n_chunks? (uint64_v*)calloc(n_chunks, sizeof(uint64_v)) : 0;
+	if (d.off[n_seq] > 0) kt_for(n_threads, worker_pack, &d, n_chunks);
+	if (d.amb) { // runs are sorted within and across jobs
+		for (c = 0; c < n_chunks; ++c) {
+			for (j = 0; j < d.amb[c].n; j += 2)
+				idx_amb_add(amb, d.amb[c].a[j], d.amb[c].a[j+1]);
+			kfree(0, d.amb[c].a);
+		}
+		free(d.amb);
+	}
+	free(d.off);
 }
 
 /******************
@@ -266,7 +867,9 @@ static void mm_idx_post(mm_idx_t *mi, int n_threads)
 
 typedef struct {
 	int mini_batch_size;
+	int n_threads;
 	uint64_t batch_size, sum_len;
+	uint64_v amb; // runs of ambiguous bases with MM_I_2BIT
 	mm_bseq_file_t *fp;
 	mm_idx_t *mi;
 } pipeline_t;
@@ -286,6 +889,121 @@ static void mm_idx_add(mm_idx_t *mi, int n, const mm128_t *a)
 	}
 }
 
+#define MM_IDX_SCATTER_MIN 0x10000 // distribute fewer minimizers than this on one thread
+
+typedef struct {
+	mm_idx_t *mi;
+	const mm128_t *a;
+	size_t n, n_per;
+	size_t *off; // off[j<<b|i]: number of minimizers part $j sends to bucket $i, and then where they go
+} scatter_shared_t;
+
+static void worker_scatter_count(void *data, long j, int tid)
+{
+	scatter_shared_t *d = (scatter_shared_t*)data;
+	size_t i, st = j * d->n_per, en = st + d->n_per < d->n? st + d->n_per : d->n, *off = &d->off[(size_t)j << d->mi->b];
+	int mask = (1<<d->mi->b) - 1;
+	for (i = st; i < en; ++i)
+		++off[d->a[i].x>>8&mask];
+}
+
+static void worker_scatter(void *data, long j, int tid)
+{
+	scatter_shared_t *d = (scatter_shared_t*)data;
+	size_t i, st = j * d->n_per, en = st + d->n_per < d->n? st + d->n_per : d->n, *off = &d->off[(size_t)j << d->mi->b];
+	int mask = (1<<d->mi->b) - 1;
+	for (i = st; i < en; ++i) {
+		int x = d->a[i].x>>8&mask;
+		d->mi->B[x].a.a[off[x]++] = d->a[i];
+	}
+}
+
+// the same as mm_idx_add(), with parts of $a counted and then copied to the buckets in parallel
+static void mm_idx_add_parallel(mm_idx_t *mi, size_t n, const mm128_t *a, int n_threads)
+{
+	scatter_shared_t d;
+	int i, j;
+	if (n_threads <= 1 || n < MM_IDX_SCATTER_MIN) {
+		mm_idx_add(mi, n, a);
+		return;
+	}
+	d.mi = mi, d.a = a, d.n = n, d.n_per = (n + n_threads - 1) / n_threads;
+	d.off = (size_t*)calloc((size_t)n_threads << mi->b, sizeof(size_t));
+	kt_for(n_threads, worker_scatter_count, &d, n_threads);
+	for (i = 0; i < 1<<mi->b; ++i) { // turn counts into offsets, keeping the order of $a within each bucket
+		mm128_v *p = &mi->B[i].a;
+		size_t c, o = p->n;
+		for (j = 0; j < n_threads; ++j)
+			c = d.off[(size_t)j << mi->b | i], d.off[(size_t)j << mi->b | i] = o, o += c;
+		kv_resize(mm128_t, 0, *p, o);
+		p->n = o;
+	}
+	kt_for(n_threads, worker_scatter, &d, n_threads);
+	free(d.off);
+}
+
+#define MM_IDX_SKETCH_CHUNK   0x400000 // long sequences are sketched in pieces of this many bases...
+#define MM_IDX_SKETCH_OVERLAP 0x1000   // ...each starting this many bases early to warm up the window
+
+typedef struct {
+	int seq, beg, st, en;    // sketch bases [st,en) of seq, reading from beg
+	mm128_v a;
+	mm_sketch_state_t *s;    // states at st and en if the sequence is split; NULL otherwise
+} sketch_job_t;
+
+typedef struct {
+	const mm_idx_t *mi;
+	const mm_bseq1_t *seq;
+	sketch_job_t *job;
+} sketch_shared_t;
+
+static void worker_sketch(void *data, long j, int tid)
+{
+	sketch_shared_t *d = (sketch_shared_t*)data;
+	sketch_job_t *b = &d->job[j];
+	const mm_bseq1_t *t = &d->seq[b->seq];
+	const mm_idx_t *mi = d->mi;
+	mm_sketch_range(0, t->seq, t->l_seq, b->beg, b->st, b->en, mi->w, mi->k, t->rid, mi->flag&MM_I_HPC, &b->a, mi, 0, b->s? &b->s[0] : 0, b->s? &b->s[1] : 0);
+}
+
+// sketch a batch of sequences into $a, in the order and with the result of calling mm_sketch() on each
+static void idx_sketch_batch(const mm_idx_t *mi, int n_seq, const mm_bseq1_t *seq, mm128_v *a, int n_threads)
+{
+	sketch_shared_t d;
+	int i, j, n_job = 0, n_redo = 0;
+	for (i = 0; i < n_seq; ++i)
+		n_job += (seq[i].l_seq + MM_IDX_SKETCH_CHUNK - 1) / MM_IDX_SKETCH_CHUNK;
+	d.mi = mi, d.seq = seq;
+	d.job = (sketch_job_t*)calloc(n_job, sizeof(sketch_job_t));
+	for (i = j = 0; i < n_seq; ++i) {
+		int st, split = seq[i].l_seq > MM_IDX_SKETCH_CHUNK;
+		for (st = 0; st < seq[i].l_seq; st += MM_IDX_SKETCH_CHUNK, ++j) {
+			sketch_job_t *b = &d.job[j];
+			b->seq = i, b->st = st;
+			b->beg = st > MM_IDX_SKETCH_OVERLAP? st - MM_IDX_SKETCH_OVERLAP : 0;
+			b->en = seq[i].l_seq - st > MM_IDX_SKETCH_CHUNK? st + MM_IDX_SKETCH_CHUNK : seq[i].l_seq;
+			if (split) b->s = (mm_sketch_state_t*)malloc(2 * sizeof(mm_sketch_state_t));
+		}
+	}
+	kt_for(n_threads, worker_sketch, &d, n_job);
+	for (j = 0; j < n_job; ++j) { // check that each piece picked up where the previous one stopped
+		sketch_job_t *b = &d.job[j];
+		if (b->st > 0 && !mm_sketch_state_eq(&b[-1].s[1], &b->s[0])) {
+			const mm_bseq1_t *t = &seq[b->seq];
+			b->a.n = 0, ++n_redo;
+			mm_sketch_range(0, t->seq, t->l_seq, b->st, b->st, b->en, mi->w, mi->k, t->rid, mi->flag&MM_I_HPC, &b->a, mi, &b[-1].s[1], 0, &b->s[1]);
+		}
+		kv_resize(mm128_t, 0, *a, a->n + b->a.n);
+		memcpy(&a->a[a->n], b->a.a, b->a.n * sizeof(mm128_t));
+		a->n += b->a.n;
+	}
+	for (j = 0; j < n_job; ++j)
+		free(d.job[j].s), kfree(0, d.job[j].a.a);
+	free(d.job);
+	if (mm_verbose >= 4 && n_redo > 0)
+		fprintf(stderr, "[M::%s::%.3f*%.2f] resketched %d out of %d pieces\n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), n_redo, n_job);
+}
+
 static void *worker_pipeline(void *shared, int step, void *in)
 {
 	int i;
@@ -307,32 +1025,26 @@ static void *worker_pipeline(void *shared, int step, void *in)
 			if (!(p->mi->flag & MM_I_NO_SEQ)) {
 				uint64_t sum_len, old_max_len, max_len;
 				for (i = 0, sum_len = 0; i < s->n_seq; ++i) sum_len += s->seq[i].l_seq;
-				old_max_len = (p->sum_len + 7) / 8;
-				max_len = (p->sum_len + sum_len + 7) / 8;
+				old_max_len = idx_S_words(p->mi, p->sum_len);
+				max_len = idx_S_words(p->mi, p->sum_len + sum_len);
 				kroundup64(old_max_len); kroundup64(max_len);
 				if (old_max_len != max_len) {
 					p->mi->S = (uint32_t*)realloc(p->mi->S, max_len * 4);
 					memset(&p->mi->S[old_max_len], 0, 4 * (max_len - old_max_len));
 				}
 			}
+			// copy the sequences
+			if (!(p->mi->flag & MM_I_NO_SEQ))
+				idx_pack_batch(p->mi->S, p->sum_len, s->n_seq, s->seq, p->n_threads, p->mi->flag & MM_I_2BIT? &p->amb : 0);
 			// populate p->mi->seq
 			for (i = 0; i < s->n_seq; ++i) {
 				mm_idx_seq_t *seq = &p->mi->seq[p->mi->n_seq];
-				uint32_t j;
 				if (!(p->mi->flag & MM_I_NO_NAME)) {
 					seq->name = (char*)kmalloc(p->mi->km, strlen(s->seq[i].name) + 1);
 					strcpy(seq->name, s->seq[i].name);
 				} else seq->name = 0;
 				seq->len = s->seq[i].l_seq;
 				seq->offset = p->sum_len;
-				// copy the sequence
-				if (!(p->mi->flag & MM_I_NO_SEQ)) {
-					for (j = 0; j < seq->len; ++j) { // TODO: this is not the fastest way, but let's first see if speed matters here
-						uint64_t o = p->sum_len + j;
-						int c = seq_nt4_table[(uint8_t)s->seq[i].seq[j]];
-						mm_seq4_set(p->mi->S, o, c);
-					}
-				}
 				// update p->sum_len and p->mi->n_seq
 				p->sum_len += seq->len;
 				s->seq[i].rid = p->mi->n_seq++;
@@ -341,11 +1053,14 @@ static void *worker_pipeline(void *shared, int step, void *in)
 		} else free(s);
     } else if (step == 1) { // step 1: compute sketch
         step_t *s = (step_t*)in;
+		if (p->n_threads > 1)
+			idx_sketch_batch(p->mi, s->n_seq, s->seq, &s->a, p->n_threads);
 		for (i = 0; i < s->n_seq; ++i) {
 			mm_bseq1_t *t = &s->seq[i];
-			if (t->l_seq > 0)
-				mm_sketch(0, t->seq, t->l_seq, p->mi->w, p->mi->k, t->rid, p->mi->flag&MM_I_HPC, &s->a, p->mi);
-			else if (mm_verbose >= 2)
+			if (t->l_seq > 0) {
+				if (p->n_threads <= 1)
+					mm_sketch(0, t->seq, t->l_seq, p->mi->w, p->mi->k, t->rid, p->mi->flag&MM_I_HPC, &s->a, p->mi);
+			} else if (mm_verbose >= 2)
 				fprintf(stderr, "[WARNING] the length database sequence '%s' is 0\n", t->name);
 			free(t->seq); free(t->name);
 		}
@@ -353,91 +1068,291 @@ static void *worker_pipeline(void *shared, int step, void *in)
 		return s;
     } else if (step == 2) { // dispatch sketch to buckets
         step_t *s = (step_t*)in;
-		mm_idx_add(p->mi, s->a.n, s->a.a);
+		mm_idx_add_parallel(p->mi, s->a.n, s->a.a, p->n_threads);
 		kfree(0, s->a.a); free(s);
 	}
     return 0;
 }
 
-uint64_t encodeKmer(const std::string &str)
+/*********************************
+ * Load down-weighted k-mers (-W) *
+ *********************************/
+
+static inline uint64_t encode_kmer(const char *str, int k)
 {
 	uint64_t kmer[2] = {0,0};
-	int k = str.length();
 	uint64_t shift1 = 2 * (k - 1);
+	int i;
 
-	for (int i = 0; i < k; ++i) 
+	for (i = 0; i < k; ++i)
 	{
 		int c = seq_nt4_table[(uint8_t)str[i]];
-		kmer[0] = kmer[0] << 2 | c;  
+		kmer[0] = kmer[0] << 2 | c;
 		kmer[1] = (kmer[1] >> 2) | (3ULL^c) << shift1;
 	}
 
 	return kmer[0] < kmer[1]? kmer[0] : kmer[1];
 }
 
-mm_idx_t *mm_idx_gen(mm_bseq_file_t *fp, int w, int k, int b, int flag, int mini_batch_size, int n_threads, uint64_t batch_size, const char *kmer_freq_filename)
+
+typedef struct {
+	const char *s;     // content of the k-mer list
+	int64_t *bd;       // chunk boundaries in $s, at line starts
+	int k, exact, n_threads;
+	uint64_v *a;       // encoded k-mers (or their keys for mm_kset_t) of each chunk
+	int64_t *n_bad;    // lines with a k-mer of the wrong length, per chunk
+	uint64_t *sum;     // checksum of each chunk
+	mm_bloom_t *bf;
+} dw_shared_t;
+
+static void worker_dw_parse(void *g, long i, int tid) // parse one chunk of "KMER COUNT" lines
 {
-	pipeline_t pl;
-	if (fp == 0 || mm_bseq_eof(fp)) return 0;
-	memset(&pl, 0, sizeof(pipeline_t));
-	pl.mini_batch_size = (uint64_t)mini_batch_size < batch_size? mini_batch_size : batch_size;
-	pl.batch_size = batch_size;
-	pl.fp = fp;
-	pl.mi = mm_idx_init(w, k, b, flag);
+	dw_shared_t *d = (dw_shared_t*)g;
+	const char *p = d->s + d->bd[i], *end = d->s + d->bd[i+1], *q;
+	uint64_v *a = &d->a[i];
+	while (p < end) {
+		while (p < end && isspace(*p)) ++p;
+		if (p == end) break;
+		for (q = p; q < end && !isspace(*q); ++q) {}
+		if (q - p == d->k) {
+			uint64_t x = encode_kmer(p, d->k);
+			kv_push(uint64_t, 0, *a, x);
+		} else ++d->n_bad[i];
+		for (p = q; p < end && *p != '\n'; ++p) {} // skip the count
+	}
+}
 
-	//Read kmer frequency file
-	/*------------------------*/
-	std::ifstream idt (kmer_freq_filename);
+static void worker_dw_key(void *g, long i, int tid) // checksum a chunk and turn it into mm_kset_t keys if needed
+{
+	dw_shared_t *d = (dw_shared_t*)g;
+	uint64_t *a = d->a[i].a, s = 0;
+	size_t j;
+	for (j = 0; j < d->a[i].n; ++j) {
+		s += mm_bloom_hash(a[j]);
+		if (d->exact) a[j] = mm_kmer_hash(a[j], d->k);
+	}
+	d->sum[i] = s;
+}
 
-	fprintf(stderr, "[M::%s::%.3f*%.2f] reading downweighted kmers\n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0));
+static void worker_dw_insert(void *g, long i, int tid)
+{
+	dw_shared_t *d = (dw_shared_t*)g;
+	size_t j;
+	if (d->n_threads > 1) {
+		for (j = 0; j < d->a[i].n; ++j)
+			mm_bloom_insert_atomic(d->bf, d->a[i].a[j]);
+	} else {
+		for (j = 0; j < d->a[i].n; ++j)
+			mm_bloom_insert(d->bf, d->a[i].a[j]);
+	}
+}
 
-	std::string kmer;
-	uint64_t cnt = 0;
-	uint64_t freq;
-	while(idt >> kmer >> freq)
-		cnt++;
+/**
+ * Parse a text list of down-weighted k-mers in one pass over a memory-mapped
+ * file; chunks of lines are parsed on all threads
+ *
+ * @return number of chunks in d->a
+ */
+static long dw_read_text(dw_shared_t *d, const char *fn, int n_threads)
+{
+	int64_t len, n_bad = 0;
+	long i, n_chunks;
+	char *s = 0;
+	int fd;
 
-	//kmer length used for kmer counting and mapping must be consistent
-	if(cnt > 0)
-	{
-		if(kmer.length() != k)
-		{
-			fprintf(stderr, "ERROR: input list of k-mers and winnowmap parameter k are inconsistent\n");
-			abort();
+	if ((fd = open(fn, O_RDONLY)) < 0) {
+		fprintf(stderr, "[ERROR]\033[1;31m failed to open file '%s' containing the downweighted kmers\033[0m\n", fn);
+		exit(1);
+	}
+	len = lseek(fd, 0, SEEK_END);
+	lseek(fd, 0, SEEK_SET);
+	if (len > 0) {
+#if defined(WIN32) || defined(_WIN32)
+		s = (char*)malloc(len);
+		for (int64_t off = 0, r; off < len; off += r)
+			if ((r = read(fd, s + off, len - off)) <= 0) break;
+#else
+		s = (char*)mmap(0, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (s == MAP_FAILED) {
+			fprintf(stderr, "[ERROR]\033[1;31m failed to map file '%s'\033[0m\n", fn);
+			exit(1);
 		}
+		madvise(s, len, MADV_SEQUENTIAL);
+#endif
 	}
 
-	//set up bloom filter
-	bloom_parameters parameters;
-	parameters.projected_element_count = std::max(cnt, (uint64_t)1000);
-	parameters.false_positive_probability = 0.001; 
-	parameters.maximum_number_of_hashes = 2;
+	// cut the file into chunks at line boundaries; a few chunks per thread for load balance
+	n_chunks = len < 1<<20? 1 : n_threads * 4;
+	d->s = s;
+	d->bd = (int64_t*)calloc(n_chunks + 1, sizeof(int64_t));
+	d->n_bad = (int64_t*)calloc(n_chunks, sizeof(int64_t));
+	d->a = (uint64_v*)calloc(n_chunks, sizeof(uint64_v));
+	for (i = 1; i < n_chunks; ++i) {
+		int64_t x = len / n_chunks * i;
+		if (x < d->bd[i-1]) x = d->bd[i-1];
+		while (x < len && s[x - 1] != '\n') ++x;
+		d->bd[i] = x;
+	}
+	d->bd[n_chunks] = len;
+	kt_for(n_threads, worker_dw_parse, d, n_chunks);
+	for (i = 0; i < n_chunks; ++i)
+		n_bad += d->n_bad[i];
 
-	if (!parameters)
-	{
-		std::cout << "Error - Invalid set of bloom filter parameters!" << std::endl;
+	//kmer length used for kmer counting and mapping must be consistent
+	if (n_bad > 0) {
+		fprintf(stderr, "[ERROR]\033[1;31m %" PRId64 " k-mers in '%s' are not %d bp long; the list of k-mers and winnowmap parameter k are inconsistent\033[0m\n", n_bad, fn, d->k);
 		exit(1);
 	}
 
-	parameters.compute_optimal_parameters();
-	pl.mi->downFilter = new bloom_filter(parameters);
+	free(d->n_bad); free(d->bd);
+#if defined(WIN32) || defined(_WIN32)
+	free(s);
+#else
+	if (len > 0) munmap(s, len);
+#endif
+	close(fd);
+	return n_chunks;
+}
 
+/**
+ * Collect the k-mers of a meryl database that pass a threshold, reading the
+ * files of the database on all threads
+ *
+ * @param spec     DIR[:EXPR]; EXPR is distinct=FRAC (default 0.9998) or threshold=INT
+ *
+ * @return number of chunks in d->a, or -1 if $spec is not a meryl database
+ */
+static long dw_read_meryl(dw_shared_t *d, const char *spec, int n_threads)
+{
+	char *dir, *expr = 0, *p;
+	struct stat st;
+	uint64_t **a, *n, thres;
+	long i, n_chunks;
+
+	dir = strdup(spec);
+	if ((p = strrchr(dir, ':')) != 0 && (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)))
+		*p = 0, expr = p + 1;
+	if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+		free(dir);
+		return -1;
+	}
+	n_chunks = mm_meryl_load(dir, d->k, expr? expr : "distinct=0.9998", n_threads, &a, &n, &thres);
+	if (n_chunks < 0) exit(1);
+	if (mm_verbose >= 3)
+		fprintf(stderr, "[M::mm_idx_gen::%.3f*%.2f] kept the kmers occurring more than %" PRIu64 " times in meryl database '%s'\n", realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), thres, dir);
+	d->a = (uint64_v*)calloc(n_chunks, sizeof(uint64_v));
+	for (i = 0; i < n_chunks; ++i)
+		d->a[i].n = d->a[i].m = n[i], d->a[i].a = a[i];
+	free(a); free(n); free(dir);
+	return n_chunks;
+}
 
-	//read the file again
-	idt.clear();
-	idt.seekg(0);
-	while(idt >> kmer >> freq)
-	{
-		pl.mi->downFilter->insert(encodeKmer(kmer));
+/**
+ * Read the down-weighted k-mers (-W) from a text list or a meryl database
+ *
+ * @param cnt      number of k-mers read
+ * @param sum      order-independent checksum of the k-mers
+ *
+ * @return number of chunks in d->a
+ */
+static long dw_collect(dw_shared_t *d, const char *fn, int n_threads, uint64_t *cnt, uint64_t *sum)
+{
+	long i, n_chunks;
+	if ((n_chunks = dw_read_meryl(d, fn, n_threads)) < 0)
+		n_chunks = dw_read_text(d, fn, n_threads);
+	d->sum = (uint64_t*)calloc(n_chunks, sizeof(uint64_t));
+	kt_for(n_threads, worker_dw_key, d, n_chunks);
+	for (i = 0, *cnt = *sum = 0; i < n_chunks; ++i)
+		*cnt += d->a[i].n, *sum += d->sum[i];
+	return n_chunks;
+}
+
+static void dw_destroy(dw_shared_t *d, long n_chunks)
+{
+	long i;
+	for (i = 0; i < n_chunks; ++i) free(d->a[i].a);
+	free(d->a); free(d->sum);
+}
+
+/**
+ * Load the down-weighted k-mers (-W) into mi->downSet (MM_I_EXACT_DOWN) or
+ * mi->downFilter; $fn is a text list of k-mers or a meryl database
+ */
+static void mm_idx_load_dw(mm_idx_t *mi, const char *fn, int n_threads)
+{
+	dw_shared_t d;
+	uint64_t cnt;
+	long i, n_chunks;
+	double t = realtime();
+
+	if (mm_verbose >= 3)
+		fprintf(stderr, "[M::mm_idx_gen::%.3f*%.2f] reading downweighted kmers\n", realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0));
+	memset(&d, 0, sizeof(dw_shared_t));
+	d.k = mi->k, d.n_threads = n_threads, d.exact = !!(mi->flag & MM_I_EXACT_DOWN);
+	n_chunks = dw_collect(&d, fn, n_threads, &cnt, &mi->down_sum);
+	mi->down_n = cnt;
+	if (mm_verbose >= 3)
+		fprintf(stderr, "[M::mm_idx_gen::%.3f*%.2f] collected downweighted kmers in %.3f sec, no. of kmers read=%" PRIu64"\n", realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), realtime() - t, cnt);
+
+	if (d.exact) {
+		uint64_t *a = (uint64_t*)malloc((cnt + 1) * sizeof(uint64_t)), n_a = 0;
+		for (i = 0; i < n_chunks; ++i) {
+			memcpy(a + n_a, d.a[i].a, d.a[i].n * sizeof(uint64_t));
+			n_a += d.a[i].n;
+		}
+		mi->downSet = mm_kset_init(a, n_a, mi->k);
+		free(a);
+		if (mm_verbose >= 3)
+			fprintf(stderr, "[M::mm_idx_gen::%.3f*%.2f] saved the kmers in an exact set in %.3f sec: distinct kmers=%" PRIu64 ", size=%.2f MB\n", realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0),
+					realtime() - t, mi->downSet->n, mm_kset_size(mi->downSet) / 1048576.0);
+	} else {
+		d.bf = mi->downFilter = mm_bloom_init(cnt, 0.001);
+		kt_for(n_threads, worker_dw_insert, &d, n_chunks);
+		mi->downFilter->n = cnt;
+		if (mm_verbose >= 3)
+			fprintf(stderr, "[M::mm_idx_gen::%.3f*%.2f] saved the kmers in a blocked bloom filter in %.3f sec: size=%.2f MB, measured false positive rate=%.5f\n", realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0),
+					realtime() - t, mi->downFilter->n_blocks * 64.0 / 1048576.0, mm_bloom_fpr(mi->downFilter, 1<<20));
+	}
+	dw_destroy(&d, n_chunks);
+}
+
+/**
+ * Check that the -W list given on the command line is the one a prebuilt index
+ * was built with; exit if not
+ */
+static void mm_idx_check_dw(const mm_idx_t *mi, const char *fn, int n_threads)
+{
+	dw_shared_t d;
+	uint64_t cnt, sum;
+	long n_chunks;
+	memset(&d, 0, sizeof(dw_shared_t));
+	d.k = mi->k, d.n_threads = n_threads;
+	n_chunks = dw_collect(&d, fn, n_threads, &cnt, &sum);
+	dw_destroy(&d, n_chunks);
+	if (cnt != mi->down_n || sum != mi->down_sum) {
+		fprintf(stderr, "[ERROR]\033[1;31m the downweighted kmers in '%s' (%" PRIu64 " kmers) differ from those the prebuilt index was built with (%" PRIu64 " kmers); rebuild the index or drop -W\033[0m\n", fn, cnt, mi->down_n);
+		exit(1);
 	}
+	if (mm_verbose >= 3)
+		fprintf(stderr, "[M::%s::%.3f*%.2f] the downweighted kmers match those stored in the prebuilt index\n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0));
+}
 
-	assert(cnt == pl.mi->downFilter->element_count());
+mm_idx_t *mm_idx_gen(mm_bseq_file_t *fp, int w, int k, int b, int flag, int occ_cap, int mini_batch_size, int n_threads, uint64_t batch_size, const char *kmer_freq_filename)
+{
+	pipeline_t pl;
+	if (fp == 0 || mm_bseq_eof(fp)) return 0;
+	memset(&pl, 0, sizeof(pipeline_t));
+	pl.mini_batch_size = (uint64_t)mini_batch_size < batch_size? mini_batch_size : batch_size;
+	pl.batch_size = batch_size;
+	pl.n_threads = n_threads;
+	pl.fp = fp;
+	pl.mi = mm_idx_init(w, k, b, flag);
+	pl.mi->occ_cap = occ_cap;
 
-	fprintf(stderr, "[M::%s::%.3f*%.2f] collected downweighted kmers, no. of kmers read=%" PRIu64"\n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), cnt);
-	fprintf(stderr, "[M::%s::%.3f*%.2f] saved the kmers in a bloom filter: hash functions=%u and size=%llu \n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), parameters.optimal_parameters.number_of_hashes, parameters.optimal_parameters.table_size);
-	/*------------------------*/
+	if (kmer_freq_filename) mm_idx_load_dw(pl.mi, kmer_freq_filename, n_threads);
 
 	kt_pipeline(n_threads < 3? n_threads : 3, worker_pipeline, &pl, 3);
+	pl.mi->n_amb = pl.amb.n / 2, pl.mi->amb = pl.amb.a;
 	if (mm_verbose >= 3)
 		fprintf(stderr, "[M::%s::%.3f*%.2f] collected minimizers\n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0));
 
@@ -454,7 +1369,7 @@ mm_idx_t *mm_idx_build(const char *fn, int w, int k, int flag, int n_threads) //
 	mm_idx_t *mi;
 	fp = mm_bseq_open(fn);
 	if (fp == 0) return 0;
-	mi = mm_idx_gen(fp, w, k, 14, flag, 1<<18, n_threads, UINT64_MAX, NULL);
+	mi = mm_idx_gen(fp, w, k, 14, flag, 0, 1<<18, n_threads, UINT64_MAX, NULL);
 	mm_bseq_close(fp);
 	return mi;
 }
@@ -481,7 +1396,6 @@ mm_idx_t *mm_idx_str(int w, int k, int is_hpc, int bucket_bits, int n, const cha
 	for (i = 0, sum_len = 0; i < n; ++i) {
 		const char *s = seq[i];
 		mm_idx_seq_t *p = &mi->seq[i];
-		uint32_t j;
 		if (name && name[i]) {
 			int absent;
 			p->name = (char*)kmalloc(mi->km, strlen(name[i]) + 1);
@@ -491,11 +1405,7 @@ mm_idx_t *mm_idx_str(int w, int k, int is_hpc, int bucket_bits, int n, const cha
 		}
 		p->offset = sum_len;
 		p->len = strlen(s);
-		for (j = 0; j < p->len; ++j) {
-			int c = seq_nt4_table[(uint8_t)s[j]];
-			uint64_t o = sum_len + j;
-			mm_seq4_set(mi->S, o, c);
-		}
+		idx_pack_seq4(mi->S, sum_len, s, p->len);
 		sum_len += p->len;
 		if (p->len > 0) {
 			a.n = 0;
@@ -514,12 +1424,18 @@ mm_idx_t *mm_idx_str(int w, int k, int is_hpc, int bucket_bits, int n, const cha
 
 void mm_idx_dump(FILE *fp, const mm_idx_t *mi)
 {
-	uint64_t sum_len = 0;
-	uint32_t x[5], i;
+	uint64_t sum_len = 0, y[3], *boff, off;
+	uint32_t x[6], i;
 
-	x[0] = mi->w, x[1] = mi->k, x[2] = mi->b, x[3] = mi->n_seq, x[4] = mi->flag;
+	x[0] = mi->w, x[1] = mi->k, x[2] = mi->b, x[3] = mi->n_seq, x[4] = mi->flag & ~(MM_I_MMAP|MM_I_POPULATE), x[5] = mi->occ_cap;
 	fwrite(MM_IDX_MAGIC, 1, 4, fp);
-	fwrite(x, 4, 5, fp);
+	fwrite(x, 4, 6, fp);
+	y[0] = mi->downSet? 2 : mi->downFilter? 1 : 0, y[1] = mi->down_n, y[2] = mi->down_sum;
+	fwrite(y, 8, 3, fp);
+	fwrite(&mi->n_occ, 8, 1, fp);
+	fwrite(mi->occ, 16, mi->n_occ, fp);
+	if (mi->downSet) mm_kset_dump(fp, mi->downSet);
+	else if (mi->downFilter) mm_bloom_dump(fp, mi->downFilter);
 	for (i = 0; i < mi->n_seq; ++i) {
 		if (mi->seq[i].name) {
 			uint8_t l = strlen(mi->seq[i].name);
@@ -532,38 +1448,128 @@ void mm_idx_dump(FILE *fp, const mm_idx_t *mi)
 		fwrite(&mi->seq[i].len, 4, 1, fp);
 		sum_len += mi->seq[i].len;
 	}
+	// offsets of the buckets and of S from the start of this table, so that they can be read in parallel
+	boff = (uint64_t*)malloc(((1ULL<<mi->b) + 1) * 8);
+	off = ((1ULL<<mi->b) + 1) * 8;
+	for (i = 0; i < 1U<<mi->b; ++i) {
+		boff[i] = off;
+		off += 4 + mi->B[i].n * 8 + 4 + mi->B[i].n_z + 4 + mi->B[i].n_keys * 16;
+	}
+	boff[1U<<mi->b] = off;
+	fwrite(boff, 8, (1ULL<<mi->b) + 1, fp);
+	free(boff);
 	for (i = 0; i < 1<<mi->b; ++i) {
 		mm_idx_bucket_t *b = &mi->B[i];
-		khint_t k;
-		idxhash_t *h = (idxhash_t*)b->h;
-		uint32_t size = h? h->size : 0;
+		uint64_t s, *val;
 		fwrite(&b->n, 4, 1, fp);
 		fwrite(b->p, 8, b->n, fp);
-		fwrite(&size, 4, 1, fp);
-		if (size == 0) continue;
-		for (k = 0; k < kh_end(h); ++k) {
+		fwrite(&b->n_z, 4, 1, fp);
+		fwrite(b->z, 1, b->n_z, fp);
+		fwrite(&b->n_keys, 4, 1, fp);
+		if (b->n_keys == 0) continue;
+		for (s = 0; s < idx_n_slots(mi, b); ++s) {
 			uint64_t x[2];
-			if (!kh_exist(h, k)) continue;
-			x[0] = kh_key(h, k), x[1] = kh_val(h, k);
+			if (!idx_slot(mi, b, s, &x[0], &val)) continue;
+			x[1] = *val;
 			fwrite(x, 8, 2, fp);
 		}
 	}
-	if (!(mi->flag & MM_I_NO_SEQ))
-		fwrite(mi->S, 4, (sum_len + 7) / 8, fp);
+	if (!(mi->flag & MM_I_NO_SEQ)) {
+		fwrite(mi->S, 4, idx_S_words(mi, sum_len), fp);
+		if (mi->flag & MM_I_2BIT) {
+			fwrite(&mi->n_amb, 8, 1, fp);
+			fwrite(mi->amb, 16, mi->n_amb, fp);
+		}
+	}
 	fflush(fp);
 }
 
-mm_idx_t *mm_idx_load(FILE *fp)
+typedef struct {
+	int fd, n_fail;
+	int64_t off;          // file offset of the bucket offset table
+	const uint64_t *boff; // offsets of the buckets and of S from $off
+	uint64_t S_len;       // size of S in bytes
+	mm_idx_t *mi;
+} idx_load_t;
+
+#define MM_IDX_S_CHUNK (1<<24) // S is read in chunks of this many bytes
+
+static int idx_pread(int fd, void *buf, uint64_t len, int64_t off) // return 0 on success
+{
+	uint8_t *p = (uint8_t*)buf;
+	while (len > 0) {
+#if defined(WIN32) || defined(_WIN32)
+		int64_t r = _lseeki64(fd, off, SEEK_SET) < 0? -1 : _read(fd, p, len < 1U<<30? len : 1U<<30);
+#else
+		int64_t r = pread(fd, p, len, off);
+#endif
+		if (r <= 0) return -1;
+		p += r, off += r, len -= r;
+	}
+	return 0;
+}
+
+static void worker_load_bucket(void *g, long i, int tid)
+{
+	idx_load_t *d = (idx_load_t*)g;
+	mm_idx_bucket_t *b = &d->mi->B[i];
+	int64_t off = d->off + d->boff[i];
+	uint32_t size;
+	int ret = 0;
+	ret |= idx_pread(d->fd, &b->n, 4, off);
+	b->p = (uint64_t*)malloc(b->n * 8);
+	ret |= idx_pread(d->fd, b->p, b->n * 8, off + 4);
+	off += 4 + b->n * 8;
+	ret |= idx_pread(d->fd, &b->n_z, 4, off);
+	if (ret == 0 && b->n_z > 0) {
+		b->z = (uint8_t*)malloc(b->n_z);
+		ret |= idx_pread(d->fd, b->z, b->n_z, off + 4);
+	}
+	off += 4 + b->n_z;
+	ret |= idx_pread(d->fd, &size, 4, off);
+	if (ret == 0 && size > 0) {
+		b->n_keys = b->a.n = b->a.m = size;
+		b->a.a = (mm128_t*)kmalloc(0, size * sizeof(mm128_t));
+		ret |= idx_pread(d->fd, b->a.a, size * 16, off + 4); // (key, value) pairs
+	}
+	if (ret) d->n_fail = 1;
+}
+
+static void worker_load_S(void *g, long i, int tid)
+{
+	idx_load_t *d = (idx_load_t*)g;
+	uint64_t st = (uint64_t)i * MM_IDX_S_CHUNK, len = d->S_len - st < MM_IDX_S_CHUNK? d->S_len - st : MM_IDX_S_CHUNK;
+	if (idx_pread(d->fd, (uint8_t*)d->mi->S + st, len, d->off + d->boff[1U<<d->mi->b] + st) != 0)
+		d->n_fail = 1;
+}
+
+static mm_idx_t *idx_load(FILE *fp, int n_threads)
 {
 	char magic[4];
-	uint32_t x[5], i;
-	uint64_t sum_len = 0;
+	uint32_t x[6], i;
+	uint64_t sum_len = 0, y[3], *boff;
+	int is_ok;
+	idx_load_t d;
 	mm_idx_t *mi;
 
 	if (fread(magic, 1, 4, fp) != 4) return 0;
 	if (strncmp(magic, MM_IDX_MAGIC, 4) != 0) return 0;
-	if (fread(x, 4, 5, fp) != 5) return 0;
+	if (fread(x, 4, 6, fp) != 6) return 0;
+	if (fread(y, 8, 3, fp) != 3) return 0;
 	mi = mm_idx_init(x[0], x[1], x[2], x[4]);
+	mi->occ_cap = x[5];
+	mi->down_n = y[1], mi->down_sum = y[2];
+	is_ok = (fread(&mi->n_occ, 8, 1, fp) == 1 && mi->n_occ >> 32 == 0); // 2^32 distinct counts would take over 2^63 minimizers
+	if (is_ok && mi->n_occ > 0) {
+		mi->occ = (uint64_t*)malloc(mi->n_occ * 16);
+		is_ok = (mi->occ && fread(mi->occ, 16, mi->n_occ, fp) == mi->n_occ);
+	}
+	if (is_ok && y[0] == 2) is_ok = ((mi->downSet = mm_kset_load(fp)) != 0);
+	else if (is_ok && y[0] == 1) is_ok = ((mi->downFilter = mm_bloom_load(fp)) != 0);
+	if (!is_ok) {
+		fprintf(stderr, "[ERROR]\033[1;31m failed to read the index; the file may be truncated\033[0m\n");
+		exit(1);
+	}
 	mi->n_seq = x[3];
 	mi->seq = (mm_idx_seq_t*)kcalloc(mi->km, mi->n_seq, sizeof(mm_idx_seq_t));
 	for (i = 0; i < mi->n_seq; ++i) {
@@ -579,34 +1585,414 @@ mm_idx_t *mm_idx_load(FILE *fp)
 		s->offset = sum_len;
 		sum_len += s->len;
 	}
-	for (i = 0; i < 1<<mi->b; ++i) {
-		mm_idx_bucket_t *b = &mi->B[i];
-		uint32_t j, size;
-		khint_t k;
-		idxhash_t *h;
-		fread(&b->n, 4, 1, fp);
-		b->p = (uint64_t*)malloc(b->n * 8);
-		fread(b->p, 8, b->n, fp);
-		fread(&size, 4, 1, fp);
-		if (size == 0) continue;
-		b->h = h = kh_init(idx);
-		kh_resize(idx, h, size);
-		for (j = 0; j < size; ++j) {
-			uint64_t x[2];
-			int absent;
-			fread(x, 8, 2, fp);
-			k = kh_put(idx, h, x[0], &absent);
-			assert(absent);
-			kh_val(h, k) = x[1];
+
+	// read the buckets and S with positioned reads, which leave the FILE alone
+	memset(&d, 0, sizeof(idx_load_t));
+	d.off = ftell(fp);
+	boff = (uint64_t*)malloc(((1ULL<<mi->b) + 1) * 8);
+	if (fread(boff, 8, (1ULL<<mi->b) + 1, fp) != (1ULL<<mi->b) + 1) d.n_fail = 1;
+	d.fd = fileno(fp), d.boff = boff, d.mi = mi;
+#if defined(WIN32) || defined(_WIN32)
+	n_threads = 1; // idx_pread() moves the shared file position
+#endif
+	if (!d.n_fail) kt_for(n_threads, worker_load_bucket, &d, 1<<mi->b);
+	if (!d.n_fail && !(mi->flag & MM_I_NO_SEQ)) {
+		d.S_len = idx_S_words(mi, sum_len) * 4;
+		mi->S = (uint32_t*)malloc(d.S_len);
+		kt_for(n_threads, worker_load_S, &d, (d.S_len + MM_IDX_S_CHUNK - 1) / MM_IDX_S_CHUNK);
+	}
+	if (d.n_fail) {
+		fprintf(stderr, "[ERROR]\033[1;31m failed to read the index; the file may be truncated\033[0m\n");
+		exit(1);
+	}
+	fseek(fp, d.off + boff[1U<<mi->b] + d.S_len, SEEK_SET);
+	free(boff);
+	if (!(mi->flag & MM_I_NO_SEQ) && (mi->flag & MM_I_2BIT)) {
+		if (fread(&mi->n_amb, 8, 1, fp) != 1) d.n_fail = 1;
+		mi->amb = (uint64_t*)malloc(mi->n_amb * 16);
+		if (!d.n_fail && fread(mi->amb, 16, mi->n_amb, fp) != mi->n_amb) d.n_fail = 1;
+		if (d.n_fail) {
+			fprintf(stderr, "[ERROR]\033[1;31m failed to read the index; the file may be truncated\033[0m\n");
+			exit(1);
+		}
+	}
+	mm_idx_post_table(mi, n_threads);
+	return mi;
+}
+
+mm_idx_t *mm_idx_load(FILE *fp)
+{
+	return idx_load(fp, 1);
+}
+
+/*
+ * Memory-mappable index (--idx-mmap). Each part is a header followed by
+ * sections at 64-byte aligned offsets from the start of the part: sequence
+ * records, NUL-terminated names, the occurrence histogram, bucket records,
+ * the per-bucket position arrays and then compressed position lists, the
+ * lookup tables, the 4-bit sequence and the down-weight structure. A 2-bit
+ * sequence (MM_I_2BIT) is instead followed, at the next aligned offset, by
+ * the number of ambiguous runs and the runs themselves. Loading maps the
+ * part and points mm_idx_t into the image, so nothing is parsed, copied or
+ * rehashed and the pages are shared through the page cache by concurrent
+ * processes.
+ */
+
+#define MM_IDX_MAP_ALIGN 64
+
+typedef struct {
+	char magic[4];
+	uint32_t x[6];                // w, k, b, n_seq, flag and occ_cap, as in mm_idx_dump()
+	uint64_t y[3];                // type (0 none, 1 bloom filter, 2 exact set), number and checksum of the -W kmers
+	uint64_t sum_len, len;        // total sequence length; size of this part in bytes
+	uint64_t off_seq, off_name, off_B, off_S;
+	uint64_t off_down, off_down2; // bloom blocks, or offsets and suffixes of the exact set
+	uint64_t down_n;              // number of bloom blocks or of exact set keys
+	uint64_t off_occ, n_occ;      // occurrence histogram
+	int32_t down_bits, down_shift;
+} mm_idx_map_hdr_t;
+
+typedef struct {
+	uint64_t offset;
+	uint32_t len, name; // name is an offset into the name section
+} mm_idx_map_seq_t;
+
+typedef struct {
+	int32_t n;          // size of the position array
+	uint32_t n_keys, n_lines; // of the lookup table, or 0 if there is none
+	uint32_t n_z;       // size of the compressed position lists
+	uint64_t off_p, off_h, off_z;
+} mm_idx_map_bucket_t;
+
+static inline uint64_t idx_map_align(uint64_t x)
+{
+	return (x + MM_IDX_MAP_ALIGN - 1) & ~(uint64_t)(MM_IDX_MAP_ALIGN - 1);
+}
+
+static void idx_map_write(FILE *fp, uint8_t *mem, uint64_t *pos, uint64_t off, const void *p, uint64_t len) // zero-pad to $off, then write to $fp or to the zeroed $mem
+{
+	static const char zero[MM_IDX_MAP_ALIGN] = {0};
+	assert(*pos <= off);
+	if (mem) {
+		if (len) memcpy(mem + off, p, len);
+		*pos = off + len;
+		return;
+	}
+	while (*pos < off) {
+		uint64_t l = off - *pos < MM_IDX_MAP_ALIGN? off - *pos : MM_IDX_MAP_ALIGN;
+		fwrite(zero, 1, l, fp);
+		*pos += l;
+	}
+	if (len) fwrite(p, 1, len, fp);
+	*pos += len;
+}
+
+static uint64_t idx_dump_map(FILE *fp, uint8_t *mem, const mm_idx_t *mi) // write the image to $fp or $mem, or neither; return its size
+{
+	mm_idx_map_hdr_t hdr;
+	mm_idx_map_seq_t *ms;
+	mm_idx_map_bucket_t *mb;
+	uint64_t off, off_amb = 0, pos = 0, name_len = 0;
+	uint32_t i, n_b = 1U<<mi->b;
+
+	memset(&hdr, 0, sizeof(mm_idx_map_hdr_t));
+	memcpy(hdr.magic, MM_IDX_MAGIC_MMAP, 4);
+	hdr.x[0] = mi->w, hdr.x[1] = mi->k, hdr.x[2] = mi->b, hdr.x[3] = mi->n_seq, hdr.x[4] = mi->flag & ~(MM_I_MMAP|MM_I_POPULATE), hdr.x[5] = mi->occ_cap;
+	hdr.y[0] = mi->downSet? 2 : mi->downFilter? 1 : 0, hdr.y[1] = mi->down_n, hdr.y[2] = mi->down_sum;
+
+	// lay out the sections
+	ms = (mm_idx_map_seq_t*)calloc(mi->n_seq, sizeof(mm_idx_map_seq_t));
+	for (i = 0; i < mi->n_seq; ++i) {
+		ms[i].offset = mi->seq[i].offset, ms[i].len = mi->seq[i].len, ms[i].name = name_len;
+		name_len += (mi->seq[i].name? strlen(mi->seq[i].name) : 0) + 1;
+		hdr.sum_len += mi->seq[i].len;
+	}
+	off = hdr.off_seq = idx_map_align(sizeof(mm_idx_map_hdr_t));
+	off += mi->n_seq * sizeof(mm_idx_map_seq_t);
+	hdr.off_name = off;
+	off += name_len;
+	off = hdr.off_occ = idx_map_align(off);
+	hdr.n_occ = mi->n_occ;
+	off += mi->n_occ * 16;
+	off = hdr.off_B = idx_map_align(off);
+	off += n_b * sizeof(mm_idx_map_bucket_t);
+	mb = (mm_idx_map_bucket_t*)calloc(n_b, sizeof(mm_idx_map_bucket_t));
+	for (i = 0; i < n_b; ++i) {
+		mb[i].n = mi->B[i].n, mb[i].off_p = off;
+		off += mi->B[i].n * 8;
+	}
+	for (i = 0; i < n_b; ++i) {
+		mb[i].n_z = mi->B[i].n_z, mb[i].off_z = off;
+		off += mi->B[i].n_z;
+	}
+	off = idx_map_align(off);
+	for (i = 0; i < n_b; ++i) { // the lookup tables, contiguous as in mm_idx_t::tab
+		if (mi->B[i].h == 0) continue;
+		mb[i].n_keys = mi->B[i].n_keys, mb[i].n_lines = mi->B[i].n_lines, mb[i].off_h = off;
+		off += (uint64_t)mi->B[i].n_lines * 64;
+	}
+	off = hdr.off_S = idx_map_align(off);
+	if (!(mi->flag & MM_I_NO_SEQ)) off += idx_S_words(mi, hdr.sum_len) * 4;
+	if (!(mi->flag & MM_I_NO_SEQ) && (mi->flag & MM_I_2BIT))
+		off = off_amb = idx_map_align(off), off += 8 + mi->n_amb * 16;
+	off = hdr.off_down = idx_map_align(off);
+	if (mi->downSet) {
+		const mm_kset_t *ks = mi->downSet;
+		hdr.down_n = ks->n, hdr.down_bits = ks->bits, hdr.down_shift = ks->shift;
+		off += ((1ULL << ks->bits) + 1) * 4;
+		off = hdr.off_down2 = idx_map_align(off);
+		off += (ks->n + MM_KSET_SCAN) * (ks->s32? 4 : 8); // zero padding for the fixed-width compare
+	} else if (mi->downFilter) {
+		hdr.down_n = mi->downFilter->n_blocks;
+		off += mi->downFilter->n_blocks * 64;
+	}
+	hdr.len = idx_map_align(off);
+	if (fp == 0 && mem == 0) goto end_dump;
+
+	// write them in the same order
+	idx_map_write(fp, mem, &pos, 0, &hdr, sizeof(mm_idx_map_hdr_t));
+	idx_map_write(fp, mem, &pos, hdr.off_seq, ms, mi->n_seq * sizeof(mm_idx_map_seq_t));
+	for (i = 0; i < mi->n_seq; ++i) {
+		const char *name = mi->seq[i].name? mi->seq[i].name : "";
+		idx_map_write(fp, mem, &pos, pos, name, strlen(name) + 1);
+	}
+	idx_map_write(fp, mem, &pos, hdr.off_occ, mi->occ, mi->n_occ * 16);
+	idx_map_write(fp, mem, &pos, hdr.off_B, mb, n_b * sizeof(mm_idx_map_bucket_t));
+	for (i = 0; i < n_b; ++i)
+		idx_map_write(fp, mem, &pos, mb[i].off_p, mi->B[i].p, mi->B[i].n * 8);
+	for (i = 0; i < n_b; ++i)
+		idx_map_write(fp, mem, &pos, mb[i].off_z, mi->B[i].z, mi->B[i].n_z);
+	for (i = 0; i < n_b; ++i)
+		if (mi->B[i].h)
+			idx_map_write(fp, mem, &pos, mb[i].off_h, mi->B[i].h, (uint64_t)mi->B[i].n_lines * 64);
+	if (!(mi->flag & MM_I_NO_SEQ))
+		idx_map_write(fp, mem, &pos, hdr.off_S, mi->S, idx_S_words(mi, hdr.sum_len) * 4);
+	if (off_amb) {
+		idx_map_write(fp, mem, &pos, off_amb, &mi->n_amb, 8);
+		idx_map_write(fp, mem, &pos, pos, mi->amb, mi->n_amb * 16);
+	}
+	if (mi->downSet) {
+		const mm_kset_t *ks = mi->downSet;
+		idx_map_write(fp, mem, &pos, hdr.off_down, ks->off, ((1ULL << ks->bits) + 1) * 4);
+		if (ks->s32) idx_map_write(fp, mem, &pos, hdr.off_down2, ks->s32, ks->n * 4);
+		else idx_map_write(fp, mem, &pos, hdr.off_down2, ks->s64, ks->n * 8);
+	} else if (mi->downFilter)
+		idx_map_write(fp, mem, &pos, hdr.off_down, mi->downFilter->b, mi->downFilter->n_blocks * 64);
+	idx_map_write(fp, mem, &pos, hdr.len, 0, 0);
+	if (fp) fflush(fp);
+end_dump:
+	free(ms); free(mb);
+	return hdr.len;
+}
+
+void mm_idx_dump_mmap(FILE *fp, const mm_idx_t *mi)
+{
+	idx_dump_map(fp, 0, mi);
+}
+
+/**
+ * Map $len bytes of the index at file offset $off
+ *
+ * @param map_len    length of the mapping, which starts at a page boundary at or before $off
+ *
+ * @return the mapping, or 0 on failure; the bytes at $off start at (char*)map + (map_len - len)
+ */
+static void *idx_map(FILE *fp, int64_t off, uint64_t len, int populate, uint64_t *map_len)
+{
+	void *map;
+#ifdef WIN32 // no mmap(); read the part into memory instead
+	*map_len = len;
+	if ((map = malloc(len)) == 0) return 0;
+	if (fseek(fp, off, SEEK_SET) != 0 || fread(map, 1, len, fp) != len) {
+		free(map);
+		return 0;
+	}
+#else
+	int flags = MAP_SHARED;
+	int64_t st = off & ~((int64_t)sysconf(_SC_PAGESIZE) - 1);
+	*map_len = len + (off - st);
+#ifdef MAP_POPULATE
+	if (populate) flags |= MAP_POPULATE;
+#endif
+	map = mmap(0, *map_len, PROT_READ, flags, fileno(fp), st);
+	if (map == MAP_FAILED) return 0;
+#ifndef MAP_POPULATE
+	if (populate) madvise(map, *map_len, MADV_WILLNEED);
+#endif
+#endif
+	return map;
+}
+
+static inline int idx_map_in(uint64_t len, uint64_t off, uint64_t size) // test if [off,off+size) lies within the first $len bytes
+{
+	return off <= len && size <= len - off;
+}
+
+static int idx_map_check(const uint8_t *base, uint64_t len) // test if all sections of the image at $base fit in its $len bytes
+{
+	mm_idx_map_hdr_t hdr;
+	const mm_idx_map_seq_t *ms;
+	const mm_idx_map_bucket_t *mb;
+	uint64_t i, n_S;
+
+	if (len < sizeof(mm_idx_map_hdr_t)) return 0;
+	memcpy(&hdr, base, sizeof(mm_idx_map_hdr_t));
+	if (hdr.len > len || hdr.x[2] == 0 || hdr.x[2] > 32) return 0;
+	len = hdr.len;
+	if (!idx_map_in(len, hdr.off_seq, (uint64_t)hdr.x[3] * sizeof(mm_idx_map_seq_t)) || hdr.off_name >= len) return 0;
+	ms = (const mm_idx_map_seq_t*)(base + hdr.off_seq);
+	for (i = 0; i < hdr.x[3]; ++i)
+		if (ms[i].name >= len - hdr.off_name) return 0;
+	if (!idx_map_in(len, hdr.off_occ, hdr.n_occ * 16)) return 0;
+	if (!idx_map_in(len, hdr.off_B, (1ULL<<hdr.x[2]) * sizeof(mm_idx_map_bucket_t))) return 0;
+	mb = (const mm_idx_map_bucket_t*)(base + hdr.off_B);
+	for (i = 0; i < 1ULL<<hdr.x[2]; ++i) {
+		if (mb[i].n < 0 || !idx_map_in(len, mb[i].off_p, (uint64_t)mb[i].n * 8) || !idx_map_in(len, mb[i].off_z, mb[i].n_z)) return 0;
+		if (mb[i].n_lines && !idx_map_in(len, mb[i].off_h, (uint64_t)mb[i].n_lines * 64)) return 0;
+	}
+	if (!(hdr.x[4] & MM_I_NO_SEQ)) {
+		n_S = hdr.x[4] & MM_I_2BIT? (hdr.sum_len + 15) / 16 : (hdr.sum_len + 7) / 8; // as idx_S_words()
+		if (!idx_map_in(len, hdr.off_S, n_S * 4)) return 0;
+		if (hdr.x[4] & MM_I_2BIT) {
+			uint64_t off_amb = idx_map_align(hdr.off_S + n_S * 4);
+			if (!idx_map_in(len, off_amb, 8) || !idx_map_in(len, off_amb + 8, *(const uint64_t*)(base + off_amb) * 16)) return 0;
 		}
 	}
+	if (hdr.y[0] == 2) {
+		if (hdr.down_bits < 0 || hdr.down_bits > 32 || !idx_map_in(len, hdr.off_down, ((1ULL << hdr.down_bits) + 1) * 4)) return 0;
+		if (!idx_map_in(len, hdr.off_down2, hdr.down_n * (hdr.down_shift <= 32? 4 : 8))) return 0;
+	} else if (hdr.y[0] == 1) {
+		if (!idx_map_in(len, hdr.off_down, hdr.down_n * 64)) return 0;
+	}
+	return 1;
+}
+
+static mm_idx_t *idx_map_attach(void *map, uint64_t map_len, uint8_t *base, uint64_t len) // point a new mm_idx_t into the image of at most $len bytes at $base within $map; NULL if it is damaged
+{
+	mm_idx_map_hdr_t hdr;
+	const mm_idx_map_seq_t *ms;
+	const mm_idx_map_bucket_t *mb;
+	const char *names;
+	mm_idx_t *mi;
+	uint32_t i;
+
+	if (!idx_map_check(base, len)) return 0;
+	memcpy(&hdr, base, sizeof(mm_idx_map_hdr_t));
+	mi = mm_idx_init(hdr.x[0], hdr.x[1], hdr.x[2], hdr.x[4]);
+	mi->occ_cap = hdr.x[5];
+	mi->map = map, mi->map_len = map_len;
+	mi->down_n = hdr.y[1], mi->down_sum = hdr.y[2];
+
+	mi->n_seq = hdr.x[3];
+	mi->seq = (mm_idx_seq_t*)kcalloc(mi->km, mi->n_seq, sizeof(mm_idx_seq_t));
+	ms = (const mm_idx_map_seq_t*)(base + hdr.off_seq);
+	names = (const char*)base + hdr.off_name;
+	for (i = 0; i < mi->n_seq; ++i) {
+		mi->seq[i].name = names[ms[i].name]? (char*)names + ms[i].name : 0;
+		mi->seq[i].offset = ms[i].offset, mi->seq[i].len = ms[i].len;
+	}
+	mi->n_occ = hdr.n_occ, mi->occ = (uint64_t*)(base + hdr.off_occ);
+	mb = (const mm_idx_map_bucket_t*)(base + hdr.off_B);
+	for (i = 0; i < 1U<<mi->b; ++i) {
+		mm_idx_bucket_t *b = &mi->B[i];
+		b->n = mb[i].n, b->p = (uint64_t*)(base + mb[i].off_p);
+		b->n_z = mb[i].n_z, b->z = base + mb[i].off_z;
+		if (mb[i].n_lines == 0) continue;
+		b->n_keys = mb[i].n_keys, b->n_lines = mb[i].n_lines;
+		b->h = base + mb[i].off_h;
+	}
 	if (!(mi->flag & MM_I_NO_SEQ)) {
-		mi->S = (uint32_t*)malloc((sum_len + 7) / 8 * 4);
-		fread(mi->S, 4, (sum_len + 7) / 8, fp);
+		mi->S = (uint32_t*)(base + hdr.off_S);
+		if (mi->flag & MM_I_2BIT) {
+			const uint64_t *p = (const uint64_t*)(base + idx_map_align(hdr.off_S + idx_S_words(mi, hdr.sum_len) * 4));
+			mi->n_amb = p[0], mi->amb = (uint64_t*)(p + 1);
+		}
+	}
+	if (hdr.y[0] == 2) {
+		mm_kset_t *ks = mi->downSet = (mm_kset_t*)calloc(1, sizeof(mm_kset_t));
+		ks->k = mi->k, ks->bits = hdr.down_bits, ks->shift = hdr.down_shift, ks->n = hdr.down_n;
+		ks->off = (uint32_t*)(base + hdr.off_down);
+		if (ks->shift <= 32) ks->s32 = (uint32_t*)(base + hdr.off_down2);
+		else ks->s64 = (uint64_t*)(base + hdr.off_down2);
+	} else if (hdr.y[0] == 1) {
+		mm_bloom_t *bf = mi->downFilter = (mm_bloom_t*)calloc(1, sizeof(mm_bloom_t));
+		bf->n_blocks = hdr.down_n, bf->n = hdr.y[1];
+		bf->b = (uint64_t*)(base + hdr.off_down);
 	}
 	return mi;
 }
 
+static mm_idx_t *mm_idx_load_mmap(FILE *fp, int flag)
+{
+	mm_idx_map_hdr_t hdr;
+	uint64_t map_len;
+	int64_t off = ftell(fp);
+	void *map;
+
+	struct stat st;
+	mm_idx_t *mi;
+
+	if (fread(&hdr, sizeof(mm_idx_map_hdr_t), 1, fp) != 1) return 0;
+	if (strncmp(hdr.magic, MM_IDX_MAGIC_MMAP, 4) != 0) return 0;
+	if (fstat(fileno(fp), &st) != 0 || off < 0 || hdr.len < sizeof(mm_idx_map_hdr_t) || hdr.len > (uint64_t)(st.st_size - off)) {
+		fprintf(stderr, "[ERROR]\033[1;31m failed to read the index; the file may be truncated\033[0m\n");
+		exit(1);
+	}
+	if ((map = idx_map(fp, off, hdr.len, !!(flag & MM_I_POPULATE), &map_len)) == 0) {
+		fprintf(stderr, "[ERROR]\033[1;31m failed to map %" PRIu64 " bytes of the index\033[0m\n", hdr.len);
+		exit(1);
+	}
+	fseek(fp, off + hdr.len, SEEK_SET);
+	if ((mi = idx_map_attach(map, map_len, (uint8_t*)map + (map_len - hdr.len), hdr.len)) == 0) {
+		fprintf(stderr, "[ERROR]\033[1;31m failed to read the index; the file may be truncated\033[0m\n");
+		exit(1);
+	}
+	return mi;
+}
+
+static int mm_idx_peek_mmap(FILE *fp) // test if the next part has the memory-mappable layout
+{
+	char magic[4];
+	int64_t off = ftell(fp);
+	int ret = fread(magic, 1, 4, fp) == 4 && strncmp(magic, MM_IDX_MAGIC_MMAP, 4) == 0;
+	fseek(fp, off, SEEK_SET);
+	return ret;
+}
+
+int mm_idx_warm(const char *fn)
+{
+#ifdef WIN32
+	fprintf(stderr, "[ERROR]\033[1;31m --idx-warm is not supported on this platform\033[0m\n");
+	return -1;
+#else
+	struct stat st;
+	uint64_t i, pg = sysconf(_SC_PAGESIZE), sum = 0;
+	volatile uint8_t *map;
+	double t = realtime();
+	int fd;
+
+	if ((fd = open(fn, O_RDONLY)) < 0 || fstat(fd, &st) != 0) {
+		fprintf(stderr, "[ERROR]\033[1;31m failed to open file '%s'\033[0m\n", fn);
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	map = (volatile uint8_t*)mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if ((void*)map == MAP_FAILED) {
+		fprintf(stderr, "[ERROR]\033[1;31m failed to map file '%s'\033[0m\n", fn);
+		return -1;
+	}
+	madvise((void*)map, st.st_size, MADV_WILLNEED);
+	for (i = 0; i < (uint64_t)st.st_size; i += pg) // fault in every page
+		sum += map[i];
+	munmap((void*)map, st.st_size);
+	if (mm_verbose >= 3)
+		fprintf(stderr, "[M::%s::%.3f*%.2f] loaded %.2f MB of '%s' into the page cache in %.3f sec\n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0),
+				st.st_size / 1048576.0, fn, realtime() - t);
+	return sum == UINT64_MAX? 1 : 0;
+#endif
+}
+
 int64_t mm_idx_is_idx(const char *fn)
 {
 	int fd, is_idx = 0;
@@ -624,8 +2010,12 @@ int64_t mm_idx_is_idx(const char *fn)
 		lseek(fd, 0, SEEK_SET);
 #endif // WIN32
 		ret = read(fd, magic, 4);
-		if (ret == 4 && strncmp(magic, MM_IDX_MAGIC, 4) == 0)
+		if (ret == 4 && (strncmp(magic, MM_IDX_MAGIC, 4) == 0 || strncmp(magic, MM_IDX_MAGIC_MMAP, 4) == 0))
 			is_idx = 1;
+		else if (ret == 4 && (strncmp(magic, "MMI", 3) == 0 || strncmp(magic, "MMM", 3) == 0)) {
+			fprintf(stderr, "[ERROR]\033[1;31m '%s' is an index of an older format; please rebuild it\033[0m\n", fn);
+			exit(1);
+		}
 	}
 	close(fd);
 	return is_idx? off_end : 0;
@@ -634,6 +2024,7 @@ int64_t mm_idx_is_idx(const char *fn)
 mm_idx_reader_t *mm_idx_reader_open(const char *fn, const mm_idxopt_t *opt, const char *fn_out)
 {
 	int64_t is_idx;
+	struct stat st;
 	mm_idx_reader_t *r;
 	is_idx = mm_idx_is_idx(fn);
 	if (is_idx < 0) return 0; // failed to open the index
@@ -645,6 +2036,8 @@ mm_idx_reader_t *mm_idx_reader_open(const char *fn, const mm_idxopt_t *opt, cons
 		r->fp.idx = fopen(fn, "rb");
 		r->idx_size = is_idx;
 	} else r->fp.seq = mm_bseq_open(fn);
+	if (strcmp(fn, "-") != 0 && stat(fn, &st) == 0)
+		r->target[0] = st.st_dev, r->target[1] = st.st_ino, r->target[2] = st.st_size, r->target[3] = st.st_mtime;
 	if (fn_out) r->fp_out = fopen(fn_out, "wb");
 	return r;
 }
@@ -657,25 +2050,160 @@ void mm_idx_reader_close(mm_idx_reader_t *r)
 	free(r);
 }
 
-mm_idx_t *mm_idx_reader_read(mm_idx_reader_t *r, int n_threads, const char *kmer_freq_filename)
+static int idx_reader_eof(const mm_idx_reader_t *r) // TODO: in extremely rare cases, mm_bseq_eof() might not work
+{
+	return r->is_idx? (feof(r->fp.idx) || ftell(r->fp.idx) == r->idx_size) : mm_bseq_eof(r->fp.seq);
+}
+
+static void idx_reader_warn_opt(const mm_idx_reader_t *r, const mm_idx_t *mi)
+{
+	if (mm_verbose >= 2 && (mi->k != r->opt.k || mi->w != r->opt.w || (mi->flag&MM_I_HPC) != (r->opt.flag&MM_I_HPC)))
+		fprintf(stderr, "[WARNING]\033[1;31m Indexing parameters (-k, -w or -H) overridden by parameters used in the prebuilt index.\033[0m\n");
+}
+
+static mm_idx_t *idx_reader_read(mm_idx_reader_t *r, int n_threads, const char *kmer_freq_filename)
 {
 	mm_idx_t *mi;
 	if (r->is_idx) {
-		mi = mm_idx_load(r->fp.idx);
-		if (mi && mm_verbose >= 2 && (mi->k != r->opt.k || mi->w != r->opt.w || (mi->flag&MM_I_HPC) != (r->opt.flag&MM_I_HPC)))
-			fprintf(stderr, "[WARNING]\033[1;31m Indexing parameters (-k, -w or -H) overridden by parameters used in the prebuilt index.\033[0m\n");
+		mi = mm_idx_peek_mmap(r->fp.idx)? mm_idx_load_mmap(r->fp.idx, r->opt.flag) : idx_load(r->fp.idx, n_threads);
+		if (mi) idx_reader_warn_opt(r, mi);
+		if (mi && kmer_freq_filename) mm_idx_check_dw(mi, kmer_freq_filename, n_threads);
+		else if (mi && mi->down_n && mm_verbose >= 3)
+			fprintf(stderr, "[M::%s::%.3f*%.2f] using the %" PRIu64 " downweighted kmers stored in the prebuilt index\n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), mi->down_n);
 	} else
-		mi = mm_idx_gen(r->fp.seq, r->opt.w, r->opt.k, r->opt.bucket_bits, r->opt.flag, r->opt.mini_batch_size, n_threads, r->opt.batch_size, kmer_freq_filename);
+		mi = mm_idx_gen(r->fp.seq, r->opt.w, r->opt.k, r->opt.bucket_bits, r->opt.flag, r->opt.occ_cap, r->opt.mini_batch_size, n_threads, r->opt.batch_size, kmer_freq_filename);
 	if (mi) {
-		if (r->fp_out) mm_idx_dump(r->fp_out, mi);
+		if (r->fp_out) {
+			if (r->opt.flag & MM_I_MMAP) mm_idx_dump_mmap(r->fp_out, mi);
+			else mm_idx_dump(r->fp_out, mi);
+		}
 		mi->index = r->n_parts++;
 	}
 	return mi;
 }
 
-int mm_idx_reader_eof(const mm_idx_reader_t *r) // TODO: in extremely rare cases, mm_bseq_eof() might not work
+#ifndef WIN32
+static void idx_shm_publish(mm_idx_reader_t *r, int fd, int n_threads, const char *kmer_freq_filename)
 {
-	return r->is_idx? (feof(r->fp.idx) || ftell(r->fp.idx) == r->idx_size) : mm_bseq_eof(r->fp.seq);
+	struct statvfs vfs;
+	uint64_t len, size, blk;
+	mm_idx_shm_hdr_t *hdr;
+	mm_idx_t *mi;
+	uint8_t *mem;
+
+	flock(fd, LOCK_EX);
+	blk = fstatvfs(fd, &vfs) == 0 && vfs.f_bsize > 0? vfs.f_bsize : 4096; // the huge page size on hugetlbfs
+	if (ftruncate(fd, blk) != 0) goto err_publish; // a non-empty segment without the magic is being published, or was abandoned
+	if ((mi = idx_reader_read(r, n_threads, kmer_freq_filename)) == 0) goto err_publish;
+	if (!idx_reader_eof(r)) {
+		fprintf(stderr, "[ERROR]\033[1;31m --idx-shm requires a single-part index; increase -I\033[0m\n");
+		idx_shm_unlink(r->shm);
+		exit(1);
+	}
+	r->n_parts = 0;
+	len = idx_dump_map(0, 0, mi);
+	size = (MM_IDX_MAP_ALIGN + len + blk - 1) / blk * blk;
+	if (ftruncate(fd, size) != 0) goto err_publish;
+	mem = (uint8_t*)mmap(0, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mem == MAP_FAILED) goto err_publish;
+	idx_dump_map(0, mem + MM_IDX_MAP_ALIGN, mi);
+	hdr = (mm_idx_shm_hdr_t*)mem;
+	hdr->len = len;
+	memcpy(hdr->target, r->target, sizeof(r->target));
+	hdr->k = r->opt.k, hdr->w = r->opt.w, hdr->flag = r->opt.flag & ~(MM_I_MMAP|MM_I_POPULATE), hdr->occ_cap = r->opt.occ_cap;
+	__sync_synchronize();
+	memcpy(hdr->magic, MM_IDX_MAGIC_MMAP, 4);
+	munmap(mem, size);
+	mm_idx_destroy(mi);
+	flock(fd, LOCK_SH);
+	if (mm_verbose >= 3)
+		fprintf(stderr, "[M::%s::%.3f*%.2f] published %.2f MB of index as '%s'\n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0),
+				size / 1048576.0, r->shm);
+	return;
+
+err_publish:
+	fprintf(stderr, "[ERROR]\033[1;31m failed to publish the index as '%s': %s\033[0m\n", r->shm, strerror(errno));
+	idx_shm_unlink(r->shm);
+	exit(1);
+}
+
+static int idx_shm_match(const mm_idx_reader_t *r, const mm_idx_shm_hdr_t *hdr) // test if $hdr was published from the input and options of $r
+{
+	if (memcmp(hdr->target, r->target, sizeof(r->target)) != 0) return 0;
+	if (r->is_idx) return 1; // the options come from the prebuilt index
+	return hdr->k == r->opt.k && hdr->w == r->opt.w && hdr->flag == (r->opt.flag & ~(MM_I_MMAP|MM_I_POPULATE)) && hdr->occ_cap == r->opt.occ_cap;
+}
+
+static mm_idx_t *idx_shm_read(mm_idx_reader_t *r, int n_threads, const char *kmer_freq_filename)
+{
+	const mm_idx_shm_hdr_t *hdr;
+	struct stat st;
+	mm_idx_t *mi;
+	uint8_t *map;
+	int fd, is_pub = 0;
+
+	for (;;) {
+		if ((fd = idx_shm_open(r->shm, O_RDWR|O_CREAT|O_EXCL)) >= 0) {
+			idx_shm_publish(r, fd, n_threads, kmer_freq_filename);
+			is_pub = 1;
+		} else if (errno == EEXIST) {
+			if ((fd = idx_shm_open(r->shm, O_RDONLY)) < 0) {
+				if (errno == ENOENT) continue; // removed by its last user in the meantime
+				break;
+			}
+			flock(fd, LOCK_SH); // waits for the publisher
+		} else break;
+		if (fstat(fd, &st) != 0) break;
+		map = st.st_size >= MM_IDX_MAP_ALIGN? (uint8_t*)mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : (uint8_t*)MAP_FAILED;
+		hdr = (const mm_idx_shm_hdr_t*)map;
+		if (map != MAP_FAILED && strncmp(hdr->magic, MM_IDX_MAGIC_MMAP, 4) == 0 && MM_IDX_MAP_ALIGN + hdr->len <= (uint64_t)st.st_size
+			&& (mi = idx_map_attach(map, st.st_size, map + MM_IDX_MAP_ALIGN, st.st_size - MM_IDX_MAP_ALIGN)) != 0) {
+			if (r->opt.flag & MM_I_POPULATE) madvise(map, st.st_size, MADV_WILLNEED);
+			mi->shm_fd = fd, mi->shm_name = strdup(r->shm);
+			if (!is_pub && !idx_shm_match(r, hdr)) {
+				fprintf(stderr, "[ERROR]\033[1;31m the index in '%s' was published from another input file or with other indexing options; use another --idx-shm name\033[0m\n", r->shm);
+				mm_idx_destroy(mi);
+				exit(1);
+			}
+			if (mm_verbose >= 3)
+				fprintf(stderr, "[M::%s::%.3f*%.2f] attached to the index in '%s'\n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), r->shm);
+			if (!is_pub && r->is_idx) idx_reader_warn_opt(r, mi);
+			if (!is_pub && kmer_freq_filename) mm_idx_check_dw(mi, kmer_freq_filename, n_threads);
+			return mi;
+		}
+		if (map != MAP_FAILED) munmap(map, st.st_size);
+		flock(fd, LOCK_UN);
+		if (st.st_size > 0 && flock(fd, LOCK_EX|LOCK_NB) == 0) { // its publisher failed
+			if (mm_verbose >= 2)
+				fprintf(stderr, "[WARNING]\033[1;31m removing the incomplete index '%s'\033[0m\n", r->shm);
+			idx_shm_unlink(r->shm);
+		} else sleep(1); // created, but not locked by its publisher yet
+		close(fd);
+	}
+	fprintf(stderr, "[ERROR]\033[1;31m failed to attach to the index '%s': %s\033[0m\n", r->shm, strerror(errno));
+	exit(1);
+}
+#else
+static mm_idx_t *idx_shm_read(mm_idx_reader_t *r, int n_threads, const char *kmer_freq_filename)
+{
+	fprintf(stderr, "[ERROR]\033[1;31m --idx-shm is not supported on this platform\033[0m\n");
+	exit(1);
+}
+#endif
+
+mm_idx_t *mm_idx_reader_read(mm_idx_reader_t *r, int n_threads, const char *kmer_freq_filename)
+{
+	mm_idx_t *mi;
+	if (r->shm == 0) return idx_reader_read(r, n_threads, kmer_freq_filename);
+	if (r->n_parts > 0) return 0;
+	mi = idx_shm_read(r, n_threads, kmer_freq_filename);
+	mi->index = r->n_parts++;
+	return mi;
+}
+
+int mm_idx_reader_eof(const mm_idx_reader_t *r)
+{
+	return r->shm? r->n_parts > 0 : idx_reader_eof(r);
 }
 
 #include <ctype.h>
@@ -0,0 +1,84 @@
+#include <stdlib.h>
+#include <assert.h>
+#include "mmpriv.h"
+#include "kmerset.h"
+
+mm_kset_t *mm_kset_init(uint64_t *a, uint64_t n, int k)
+{
+	mm_kset_t *ks;
+	uint64_t i, m, n_b;
+	assert(n < UINT32_MAX);
+	radix_sort_64(a, a + n);
+	for (i = m = 0; i < n; ++i) // deduplicate
+		if (m == 0 || a[i] != a[m - 1])
+			a[m++] = a[i];
+	ks = (mm_kset_t*)calloc(1, sizeof(mm_kset_t));
+	ks->k = k, ks->n = m;
+	for (ks->bits = 1; (4ULL << ks->bits) < m; ++ks->bits) {} // 2-4 k-mers per bucket
+	if (ks->bits > 2 * k) ks->bits = 2 * k;
+	ks->shift = 2 * k - ks->bits;
+	n_b = 1ULL << ks->bits;
+	ks->off = (uint32_t*)calloc(n_b + 1, 4);
+	for (i = 0; i < m; ++i) ++ks->off[(a[i] >> ks->shift) + 1];
+	for (i = 1; i <= n_b; ++i) ks->off[i] += ks->off[i - 1];
+	if (ks->shift <= 32) {
+		ks->s32 = (uint32_t*)calloc(m + MM_KSET_SCAN, 4);
+		for (i = 0; i < m; ++i) ks->s32[i] = (uint32_t)(a[i] & ((1ULL << ks->shift) - 1));
+	} else {
+		ks->s64 = (uint64_t*)calloc(m + MM_KSET_SCAN, 8);
+		for (i = 0; i < m; ++i) ks->s64[i] = a[i] & ((1ULL << ks->shift) - 1);
+	}
+	return ks;
+}
+
+void mm_kset_destroy(mm_kset_t *ks)
+{
+	if (ks == 0) return;
+	free(ks->off); free(ks->s32); free(ks->s64);
+	free(ks);
+}
+
+uint64_t mm_kset_size(const mm_kset_t *ks)
+{
+	return ((1ULL << ks->bits) + 1) * 4 + ks->n * (ks->s32? 4 : 8);
+}
+
+void mm_kset_dump(FILE *fp, const mm_kset_t *ks)
+{
+	int32_t x[3];
+	x[0] = ks->k, x[1] = ks->bits, x[2] = ks->shift;
+	fwrite(x, 4, 3, fp);
+	fwrite(&ks->n, 8, 1, fp);
+	fwrite(ks->off, 4, (1ULL << ks->bits) + 1, fp);
+	if (ks->s32) fwrite(ks->s32, 4, ks->n, fp);
+	else fwrite(ks->s64, 8, ks->n, fp);
+}
+
+mm_kset_t *mm_kset_load(FILE *fp)
+{
+	int32_t x[3];
+	uint64_t i;
+	mm_kset_t *ks;
+	if (fread(x, 4, 3, fp) != 3) return 0;
+	if (x[0] <= 0 || x[0] > 32 || x[1] < 0 || x[1] > 2 * x[0] || x[2] != 2 * x[0] - x[1]) return 0;
+	ks = (mm_kset_t*)calloc(1, sizeof(mm_kset_t));
+	ks->k = x[0], ks->bits = x[1], ks->shift = x[2];
+	if (fread(&ks->n, 8, 1, fp) != 1) goto fail_load;
+	ks->off = (uint32_t*)malloc(((1ULL << ks->bits) + 1) * 4);
+	if (fread(ks->off, 4, (1ULL << ks->bits) + 1, fp) != (1ULL << ks->bits) + 1) goto fail_load;
+	if (ks->n >= UINT32_MAX || ks->off[0] != 0 || ks->off[1ULL << ks->bits] != ks->n) goto fail_load;
+	for (i = 0; i < 1ULL << ks->bits; ++i) // mm_kset_contains() trusts the offsets
+		if (ks->off[i] > ks->off[i + 1]) goto fail_load;
+	if (ks->shift <= 32) {
+		ks->s32 = (uint32_t*)calloc(ks->n + MM_KSET_SCAN, 4);
+		if (ks->s32 == 0 || fread(ks->s32, 4, ks->n, fp) != ks->n) goto fail_load;
+	} else {
+		ks->s64 = (uint64_t*)calloc(ks->n + MM_KSET_SCAN, 8);
+		if (ks->s64 == 0 || fread(ks->s64, 8, ks->n, fp) != ks->n) goto fail_load;
+	}
+	return ks;
+
+fail_load:
+	mm_kset_destroy(ks);
+	return 0;
+}
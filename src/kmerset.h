@@ -0,0 +1,76 @@
+#ifndef MM_KMERSET_H
+#define MM_KMERSET_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Exact read-only set of 2k-bit keys, used for down-weighted k-mers keyed by
+ * mm_kmer_hash(), which is invertible and uniform. The distinct keys are sorted;
+ * their top $bits bits index an offset table and only the remaining $shift
+ * bits are stored, in 32-bit words whenever they fit. A bucket holds two to
+ * four keys on average, so a lookup is two dependent loads plus a fixed-width compare.
+ */
+
+#define MM_KSET_SCAN 8 // bucket size compared without branches
+
+typedef struct mm_kset_s {
+	int32_t k, bits, shift; // key length is 2*k; bits indexing $off; shift = 2*k - bits
+	uint64_t n;             // number of distinct keys
+	uint32_t *off;          // (1<<bits) + 1 offsets into $s32 or $s64
+	uint32_t *s32;          // low $shift bits of each key if shift <= 32
+	uint64_t *s64;          // otherwise the low $shift bits in 64-bit words
+} mm_kset_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Build a set from $n keys of 2*$k bits
+ *
+ * @param a      keys; sorted in place and not retained
+ * @param n      number of keys in $a, possibly with duplicates
+ * @param k      k-mer length
+ *
+ * @return the set; free with mm_kset_destroy()
+ */
+mm_kset_t *mm_kset_init(uint64_t *a, uint64_t n, int k);
+
+void mm_kset_destroy(mm_kset_t *ks);
+
+/**
+ * Size of the set in bytes
+ */
+uint64_t mm_kset_size(const mm_kset_t *ks);
+
+void mm_kset_dump(FILE *fp, const mm_kset_t *ks);
+mm_kset_t *mm_kset_load(FILE *fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+static inline void mm_kset_prefetch(const mm_kset_t *ks, uint64_t x)
+{
+	__builtin_prefetch(&ks->off[x >> ks->shift]);
+}
+
+static inline int mm_kset_contains(const mm_kset_t *ks, uint64_t x)
+{
+	uint64_t b = x >> ks->shift;
+	uint32_t i = ks->off[b], e = ks->off[b + 1], r = 0, t;
+	x &= (1ULL << ks->shift) - 1;
+	if (e - i <= MM_KSET_SCAN) { // the common case: compare a fixed window without branches; the arrays are padded
+		if (ks->s32) {
+			for (t = 0; t < MM_KSET_SCAN; ++t) r |= (i + t < e) & (ks->s32[i + t] == x);
+		} else {
+			for (t = 0; t < MM_KSET_SCAN; ++t) r |= (i + t < e) & (ks->s64[i + t] == x);
+		}
+	} else {
+		for (; i < e && !r; ++i) r = ks->s32? ks->s32[i] == x : ks->s64[i] == x;
+	}
+	return r;
+}
+
+#endif
@@ -8,6 +8,7 @@
 #include "mmpriv.h"
 #include "ketopt.h"
 #include <thread>
+#include <algorithm>
 
 #define MM_VERSION "2.03"
 
@@ -88,6 +89,18 @@ static ko_longopt_t long_options[] = {
 	{ "junc-bonus",     ko_required_argument, 341 },
 	{ "sam-hit-only",   ko_no_argument,       342 },
 	{ "sv-off",         ko_no_argument,       343 },
+	{ "exact-W",        ko_no_argument,       344 },
+	{ "idx-mmap",       ko_no_argument,       345 },
+	{ "idx-populate",   ko_no_argument,       346 },
+	{ "idx-warm",       ko_no_argument,       347 },
+	{ "idx-2bit",       ko_no_argument,       348 },
+	{ "idx-pack-pos",   ko_no_argument,       349 },
+	{ "idx-max-occ",    ko_required_argument, 350 },
+	{ "batch-seed",     ko_no_argument,       351 },
+	{ "idx-shm",        ko_required_argument, 352 },
+	{ "chain-inc",      ko_no_argument,       353 },
+	{ "chain-mapq",     ko_no_argument,       354 },
+	{ "fast-unique",    ko_no_argument,       355 },
 	{ "help",           ko_no_argument,       'h' },
 	{ "max-intron-len", ko_required_argument, 'G' },
 	{ "version",        ko_no_argument,       'V' },
@@ -126,14 +139,15 @@ static inline void yes_or_no(mm_mapopt_t *opt, int flag, int long_idx, const cha
 int main(int argc, char *argv[])
 {
 	unsetenv((char *)"MALLOC_ARENA_MAX"); //for openmp
-	const char *opt_str = "2aSDw:W:k:K:t:r:f:Vv:g:G:I:XT:s:x:Hcp:M:n:z:A:B:O:E:m:N:Qu:R:hF:LC:yYPo:";
+	const char *opt_str = "2aSDd:w:W:k:K:t:r:f:Vv:g:G:I:XT:s:x:Hcp:M:n:z:A:B:O:E:m:N:Qu:R:hF:LC:yYPo:";
 	ketopt_t o = KETOPT_INIT;
 	mm_mapopt_t opt;
 	mm_idxopt_t ipt;
 	int i, c, n_threads = std::max(3, get_cpu_count()/OMP_PER_READ_THREADS), n_parts, old_best_n = -1;
 	bool n_threads_override = false;
 	//by default, we set pthread count to half of hardware supported threads
-	char *fnw = 0, *rg = 0, *junc_bed = 0, *s;
+	char *fnw = 0, *rg = 0, *junc_bed = 0, *idx_shm = 0, *s;
+	int idx_warm = 0;
 	FILE *fp_help = stderr;
 	mm_idx_reader_t *idx_rdr;
 	mm_idx_t *mi;
@@ -164,7 +178,7 @@ int main(int argc, char *argv[])
 		else if (c == 'W') opt.kmer_freq_filename = o.arg;
 		else if (c == 'k') ipt.k = atoi(o.arg);
 		else if (c == 'H') ipt.flag |= MM_I_HPC;
-		/*else if (c == 'd') fnw = o.arg; // the above are indexing related options, except -I*/
+		else if (c == 'd') fnw = o.arg; // the above are indexing related options, except -I
 		else if (c == 'r') opt.bw = (int)mm_parse_num(o.arg);
 		else if (c == 't') {n_threads = atoi(o.arg) / OMP_PER_READ_THREADS; n_threads_override = true;}
 		else if (c == 'v') mm_verbose = atoi(o.arg);
@@ -236,6 +250,18 @@ int main(int argc, char *argv[])
 		else if (c == 338) opt.max_qlen = mm_parse_num(o.arg); // --max-qlen
 		else if (c == 340) junc_bed = o.arg; // --junc-bed
 		else if (c == 342) opt.flag |= MM_F_SAM_HIT_ONLY; // --sam-hit-only
+		else if (c == 344) ipt.flag |= MM_I_EXACT_DOWN; // --exact-W
+		else if (c == 345) ipt.flag |= MM_I_MMAP; // --idx-mmap
+		else if (c == 346) ipt.flag |= MM_I_POPULATE; // --idx-populate
+		else if (c == 347) idx_warm = 1; // --idx-warm
+		else if (c == 348) ipt.flag |= MM_I_2BIT; // --idx-2bit
+		else if (c == 349) ipt.flag |= MM_I_PACK_POS; // --idx-pack-pos
+		else if (c == 350) ipt.occ_cap = atoi(o.arg); // --idx-max-occ
+		else if (c == 351) opt.flag |= MM_F_BATCH_SEED; // --batch-seed
+		else if (c == 352) idx_shm = o.arg; // --idx-shm
+		else if (c == 353) opt.flag |= MM_F_CHAIN_INC; // --chain-inc
+		else if (c == 354) opt.flag |= MM_F_CHAIN_MAPQ; // --chain-mapq
+		else if (c == 355) opt.flag |= MM_F_FAST_UNIQUE; // --fast-unique
 		else if (c == 343) {
 			opt.SVaware = false; // --sv-off (defaults back to ISMB'20 version)
 			if (n_threads_override == false) // --adjust thread count as openmp is not used
@@ -318,7 +344,19 @@ int main(int argc, char *argv[])
 		fprintf(fp_help, "    -k INT       k-mer size (no larger than 28) [%d]\n", ipt.k);
 		fprintf(fp_help, "    -w INT       minimizer window size [%d]\n", ipt.w);
     fprintf(fp_help, "    -I NUM       split index for every ~NUM input bases [4G]\n");
-		fprintf(fp_help, "    -W FILE      input file containing list of high frequency k-mers []\n");
+    fprintf(fp_help, "    -d FILE      dump index, including the -W kmers, to FILE []\n");
+		fprintf(fp_help, "    -W FILE|DIR  list of high frequency k-mers, or a meryl database DIR[:distinct=FRAC|threshold=INT]\n");
+		fprintf(fp_help, "                 whose k-mers above the threshold are used [DIR:distinct=0.9998]\n");
+		fprintf(fp_help, "    --exact-W    store the -W k-mers in an exact set instead of a bloom filter\n");
+		fprintf(fp_help, "    --idx-mmap   with -d, write an index that is memory-mapped and used in place when loaded\n");
+		fprintf(fp_help, "    --idx-populate  pre-fault a memory-mapped index at load time\n");
+		fprintf(fp_help, "    --idx-warm   read <target.idx> into the page cache and exit\n");
+		fprintf(fp_help, "    --idx-shm NAME  share one copy of the index among concurrent jobs in shared memory NAME\n");
+		fprintf(fp_help, "                 (or a file path, e.g. on hugetlbfs); the first job publishes it\n");
+		fprintf(fp_help, "    --idx-2bit   store the reference in 2 bits per base, with ambiguous bases kept aside\n");
+		fprintf(fp_help, "    --idx-pack-pos  store the positions of repetitive minimizers compressed\n");
+		fprintf(fp_help, "    --idx-max-occ INT  store no positions of minimizers occurring INT or more times;\n");
+		fprintf(fp_help, "                 INT below %d needs -f at mapping to filter more minimizers [0, keep all]\n", opt.mid_occ);
 		fprintf(fp_help, "  Mapping:\n");
 		fprintf(fp_help, "    -f FLOAT     filter out top FLOAT (<1) fraction of repetitive minimizers [0.0]\n");
 		fprintf(fp_help, "    -g NUM       stop chain enlongation if there are no minimizers in INT-bp [%d]\n", opt.max_gap);
@@ -331,6 +369,10 @@ int main(int argc, char *argv[])
 		fprintf(fp_help, "    -X           skip self and dual mappings (for the all-vs-all mode)\n");
 		fprintf(fp_help, "    -p FLOAT     min secondary-to-primary score ratio [%g]\n", opt.pri_ratio);
 		fprintf(fp_help, "    --sv-off     turn off SV-aware mode\n");
+		fprintf(fp_help, "    --batch-seed look up the minimizers of each minibatch together, in index order\n");
+		fprintf(fp_help, "    --chain-inc  when growing a substring, rechain only where new minimizers may matter (faster, approximate)\n");
+		fprintf(fp_help, "    --chain-mapq skip aligning substrings whose chains lie in many equally good repeat copies\n");
+		fprintf(fp_help, "    --fast-unique map reads that chain end to end in unique sequence without the MCAS search\n");
 		/*fprintf(fp_help, "    -N INT       retain at most INT secondary alignments [%d]\n", opt.best_n);*/
 		fprintf(fp_help, "  Alignment:\n");
 		fprintf(fp_help, "    -A INT       matching score [%d]\n", opt.a);
@@ -369,11 +411,13 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "[ERROR] incorrect input: in the sr mode, please specify no more than two query files.\n");
 		return 1;
 	}
+	if (idx_warm) return mm_idx_warm(argv[o.ind]) < 0? 1 : 0;
 	idx_rdr = mm_idx_reader_open(argv[o.ind], &ipt, fnw);
 	if (idx_rdr == 0) {
 		fprintf(stderr, "[ERROR] failed to open file '%s': %s\n", argv[o.ind], strerror(errno));
 		return 1;
 	}
+	idx_rdr->shm = idx_shm;
 	if (!idx_rdr->is_idx && fnw == 0 && argc - o.ind < 2) {
 		fprintf(stderr, "[ERROR] missing input: please specify a query file to map\n");
 		mm_idx_reader_close(idx_rdr);
@@ -5,6 +5,8 @@
 #include <cinttypes>
 #include <algorithm>
 #include <tuple>
+#include <vector>
+#include <cmath>
 #include <omp.h>
 #include <iostream>
 #include "kthread.h"
@@ -17,6 +19,7 @@
 
 struct mm_tbuf_s {
 	void *km;
+	const mm_seed_cache_t *sc; // hits of the read looked up by mm_seed_batch(), or NULL
 	int rep_len, frag_gap;
 };
 
@@ -83,10 +86,21 @@ static void collect_minimizers(void *km, const mm_mapopt_t *opt, const mm_idx_t
 	}
 }
 
+static void collect_minimizers_sub(void *km, const mm_mapopt_t *opt, const mm_idx_t *mi, const mm_sketch_cache_t *sc, int st, int len, mm128_v *mv) // the same as collect_minimizers() on [st,st+len) of a single segment
+{
+	mv->n = 0;
+	mm_sketch_sub(km, sc, st, len, mv, mi);
+	if (opt->sdust_thres > 0)
+		mv->n = mm_dust_minier(km, mv->n, mv->a, len, sc->str + st, opt->sdust_thres);
+}
+
 #include "ksort.h"
 #define heap_lt(a, b) ((a).x > (b).x)
 KSORT_INIT(heap, mm128_t, heap_lt)
 
+#define MM_SEED_GROUP   0x2000000 // bases of reads seeded together with --batch-seed
+#define MM_LOOKUP_BLOCK 16 // number of minimizers looked up together
+
 	typedef struct {
 		uint32_t n;
 		uint32_t q_pos, q_span;
@@ -94,20 +108,45 @@ KSORT_INIT(heap, mm128_t, heap_lt)
 		const uint64_t *cr;
 	} mm_match_t;
 
-static mm_match_t *collect_matches(void *km, int *_n_m, int max_occ, const mm_idx_t *mi, const mm128_v *mv, int64_t *n_a, int *rep_len, int *n_mini_pos, uint64_t **mini_pos)
+// positions compressed in the index are decoded into *pos, which the caller frees along with the matches
+static mm_match_t *collect_matches(void *km, const mm_seed_cache_t *sc, int *_n_m, int max_occ, const mm_idx_t *mi, const mm128_v *mv, int64_t *n_a, int *rep_len, int *n_mini_pos, uint64_t **mini_pos, uint64_t **pos)
 {
-	int rep_st = 0, rep_en = 0, n_m;
+	int rep_st = 0, rep_en = 0, n_m, cnt[MM_LOOKUP_BLOCK];
+	int64_t n_z = 0;
 	size_t i;
 	mm_match_t *m;
-	*n_mini_pos = 0;
+	uint64_t minier[MM_LOOKUP_BLOCK];
+	const uint64_t *crs[MM_LOOKUP_BLOCK];
+	const uint8_t **z = 0, *zs[MM_LOOKUP_BLOCK];
+	*n_mini_pos = 0, *pos = 0;
 	*mini_pos = (uint64_t*)kmalloc(km, mv->n * sizeof(uint64_t));
 	m = (mm_match_t*)kmalloc(km, mv->n * sizeof(mm_match_t));
 	for (i = 0, n_m = 0, *rep_len = 0, *n_a = 0; i < mv->n; ++i) {
 		const uint64_t *cr;
+		const uint8_t *zq;
 		mm128_t *p = &mv->a[i];
 		uint32_t q_pos = (uint32_t)p->y, q_span = p->x & 0xff;
-		int t;
-		cr = mm_idx_get(mi, p->x>>8, &t);
+		int t, j = i % MM_LOOKUP_BLOCK;
+		if (j == 0) { // look up the next block, skipping minimizers already in the seed cache
+			int k, l, n = mv->n - i < MM_LOOKUP_BLOCK? mv->n - i : MM_LOOKUP_BLOCK, miss[MM_LOOKUP_BLOCK];
+			for (k = l = 0; k < n; ++k) {
+				uint64_t x = mv->a[i + k].x>>8;
+				const mm_seed_ent_t *e = sc? mm_seed_cache_get(sc, x) : 0;
+				if (e) cnt[k] = e->n, crs[k] = e->cr, zs[k] = e->z;
+				else minier[l] = x, miss[l++] = k;
+			}
+			if (l == n) {
+				mm_idx_get_batch(mi, n, minier, cnt, crs, zs);
+			} else if (l > 0) {
+				int c[MM_LOOKUP_BLOCK];
+				const uint64_t *r[MM_LOOKUP_BLOCK];
+				const uint8_t *y[MM_LOOKUP_BLOCK];
+				mm_idx_get_batch(mi, l, minier, c, r, y);
+				for (k = 0; k < l; ++k)
+					cnt[miss[k]] = c[k], crs[miss[k]] = r[k], zs[miss[k]] = y[k];
+			}
+		}
+		cr = crs[j], t = cnt[j], zq = zs[j];
 		if (t >= max_occ) {
 			int en = (q_pos >> 1) + 1, st = en - q_span;
 			if (st > rep_en) {
@@ -122,8 +161,21 @@ static mm_match_t *collect_matches(void *km, int *_n_m, int max_occ, const mm_id
 			if (i < mv->n - 1 && p->x>>8 == mv->a[i + 1].x>>8) q->is_tandem = 1;
 			*n_a += q->n;
 			(*mini_pos)[(*n_mini_pos)++] = (uint64_t)q_span<<32 | q_pos>>1;
+			if (zq) {
+				if (z == 0) z = (const uint8_t**)kcalloc(km, mv->n, sizeof(const uint8_t*));
+				z[n_m - 1] = zq, n_z += t;
+			}
+		}
+	}
+	if (n_z > 0) { // decode all compressed position lists into one buffer
+		uint64_t *a = *pos = (uint64_t*)kmalloc(km, n_z * sizeof(uint64_t));
+		for (i = 0; i < (size_t)n_m; ++i) {
+			if (z[i] == 0) continue;
+			mm_idx_unpack_pos(z[i], m[i].n, a);
+			m[i].cr = a, a += m[i].n;
 		}
 	}
+	kfree(km, z);
 	*rep_len += rep_en - rep_st;
 	*_n_m = n_m;
 	return m;
@@ -153,15 +205,16 @@ static inline int skip_seed(int flag, uint64_t r, const mm_match_t *q, const cha
 	return 0;
 }
 
-static mm128_t *collect_seed_hits_heap(void *km, const mm_mapopt_t *opt, int max_occ, const mm_idx_t *mi, const char *qname, const mm128_v *mv, int qlen, int64_t *n_a, int *rep_len,
+static mm128_t *collect_seed_hits_heap(void *km, const mm_seed_cache_t *sc, const mm_mapopt_t *opt, int max_occ, const mm_idx_t *mi, const char *qname, const mm128_v *mv, int qlen, int64_t *n_a, int *rep_len,
 		int *n_mini_pos, uint64_t **mini_pos)
 {
 	int i, n_m, heap_size = 0;
 	int64_t j, n_for = 0, n_rev = 0;
+	uint64_t *pos;
 	mm_match_t *m;
 	mm128_t *a, *heap;
 
-	m = collect_matches(km, &n_m, max_occ, mi, mv, n_a, rep_len, n_mini_pos, mini_pos);
+	m = collect_matches(km, sc, &n_m, max_occ, mi, mv, n_a, rep_len, n_mini_pos, mini_pos, &pos);
 
 	heap = (mm128_t*)kmalloc(km, n_m * sizeof(mm128_t));
 	a = (mm128_t*)kmalloc(km, *n_a * sizeof(mm128_t));
@@ -204,6 +257,7 @@ static mm128_t *collect_seed_hits_heap(void *km, const mm_mapopt_t *opt, int max
 		ks_heapdown_heap(0, heap_size, heap);
 	}
 	kfree(km, m);
+	kfree(km, pos);
 	kfree(km, heap);
 
 	// reverse anchors on the reverse strand, as they are in the descending order
@@ -219,13 +273,14 @@ static mm128_t *collect_seed_hits_heap(void *km, const mm_mapopt_t *opt, int max
 	return a;
 }
 
-static mm128_t *collect_seed_hits(void *km, const mm_mapopt_t *opt, int max_occ, const mm_idx_t *mi, const char *qname, const mm128_v *mv, int qlen, int64_t *n_a, int *rep_len,
+static mm128_t *collect_seed_hits(void *km, const mm_seed_cache_t *sc, const mm_mapopt_t *opt, int max_occ, const mm_idx_t *mi, const char *qname, const mm128_v *mv, int qlen, int64_t *n_a, int *rep_len,
 		int *n_mini_pos, uint64_t **mini_pos)
 {
 	int i, n_m;
+	uint64_t *pos;
 	mm_match_t *m;
 	mm128_t *a;
-	m = collect_matches(km, &n_m, max_occ, mi, mv, n_a, rep_len, n_mini_pos, mini_pos);
+	m = collect_matches(km, sc, &n_m, max_occ, mi, mv, n_a, rep_len, n_mini_pos, mini_pos, &pos);
 	a = (mm128_t*)kmalloc(km, *n_a * sizeof(mm128_t));
 	for (i = 0, *n_a = 0; i < n_m; ++i) {
 		mm_match_t *q = &m[i];
@@ -249,6 +304,7 @@ static mm128_t *collect_seed_hits(void *km, const mm_mapopt_t *opt, int max_occ,
 		}
 	}
 	kfree(km, m);
+	kfree(km, pos);
 	radix_sort_128x(a, a + (*n_a));
 	return a;
 }
@@ -276,6 +332,102 @@ static mm_reg1_t *align_regs(const mm_mapopt_t *opt, const mm_idx_t *mi, void *k
 	return regs;
 }
 
+/*
+ * Stage-1 confidence from the chains alone (--chain-mapq): score, subsc, cnt
+ * and rep_len, through mm_set_mapq() without alignment, scaled by the identity
+ * that mm_est_err() infers from the anchor density. A substring is worth
+ * aligning if a primary chain reaches min_mapq this way, or if it has fewer
+ * than MM_CHAIN_MAPQ_MAX_SUB near-equal rivals: alignment may still tell a
+ * few copies of a repeat apart by their PSVs, but not dozens. On simulated
+ * reads, substrings that passed after alignment had at most 5 such rivals.
+ */
+#define MM_CHAIN_MAPQ_MAX_SUB 16
+
+static int stage1_may_pass(const mm_mapopt_t *opt, void *km, int n_regs, mm_reg1_t *regs, int rep_len, int is_sr)
+{
+	int i;
+	mm_set_mapq(km, n_regs, regs, opt->min_chain_score, opt->a, rep_len, is_sr);
+	for (i = 0; i < n_regs; ++i)
+		if (regs[i].parent == regs[i].id && (regs[i].mapq * (1.0f - regs[i].div) >= opt->min_mapq || regs[i].n_sub < MM_CHAIN_MAPQ_MAX_SUB))
+			return 1;
+	return 0;
+}
+
+/*
+ * Map a read in unique sequence without the MCAS search (--fast-unique). The
+ * whole read is chained once, as on the default route. If its best chain
+ * spans most of it, no other chain comes close in score and few of its bases
+ * are covered by repetitive minimizers, and no gap between its anchors opens
+ * a large insertion or deletion, the chains are aligned right away and the
+ * read is done. Reads touching repeats or SV-like breakpoints fail one of
+ * these tests and keep the full search.
+ */
+#define MM_UNIQUE_MIN_SPAN  0.9f  // min fraction of the read spanned by the best chain
+#define MM_UNIQUE_MAX_SUB   0.5f  // max subsc/score of the best chain
+#define MM_UNIQUE_MAX_REP   0.05f // max fraction of the read covered by repetitive minimizers
+#define MM_UNIQUE_MAX_INDEL 100   // max difference between the reference and query gaps of adjacent anchors
+
+static int map_frag_unique(const mm_mapopt_t *opt, const mm_idx_t *mi, mm_tbuf_t *b, const mm_sketch_cache_t *skc, int qlen, const char *seq, const char *qname, int *n_regs, mm_reg1_t **regs)
+{
+	int i, rep_len, n_regs0, n_mini_pos, max_chain_gap_ref, min_chain_gap_ref, is_unique = 0, is_sr = !!(opt->flag & MM_F_SR);
+	uint32_t hash;
+	int64_t n_a;
+	uint64_t *u, *mini_pos;
+	mm128_t *a;
+	mm128_v mv = {0,0,0};
+	mm_reg1_t *regs0, *r = 0;
+
+	if (opt->max_qlen > 0 && qlen > opt->max_qlen) return 0; // left unmapped, as on the default route
+	collect_minimizers_sub(b->km, opt, mi, skc, 0, qlen, &mv);
+	if (opt->flag & MM_F_HEAP_SORT) a = collect_seed_hits_heap(b->km, b->sc, opt, opt->mid_occ, mi, qname, &mv, qlen, &n_a, &rep_len, &n_mini_pos, &mini_pos);
+	else a = collect_seed_hits(b->km, b->sc, opt, opt->mid_occ, mi, qname, &mv, qlen, &n_a, &rep_len, &n_mini_pos, &mini_pos);
+	kfree(b->km, mv.a);
+	kfree(b->km, mini_pos);
+	if (rep_len > qlen * MM_UNIQUE_MAX_REP) {
+		kfree(b->km, a);
+		return 0;
+	}
+
+	hash  = qname? __ac_X31_hash_string(qname) : 0;
+	hash ^= __ac_Wang_hash(qlen) + __ac_Wang_hash(opt->seed);
+	hash  = __ac_Wang_hash(hash);
+
+	if (opt->max_gap_ref > 0) max_chain_gap_ref = opt->max_gap_ref;
+	else if (opt->max_frag_len > 0) {
+		max_chain_gap_ref = opt->max_frag_len - qlen;
+		if (max_chain_gap_ref < opt->max_gap) max_chain_gap_ref = opt->max_gap;
+	} else max_chain_gap_ref = opt->max_gap;
+	min_chain_gap_ref = opt->min_gap_ref < max_chain_gap_ref? opt->min_gap_ref : max_chain_gap_ref;
+
+	a = mm_chain_dp(max_chain_gap_ref, min_chain_gap_ref, is_sr && qlen > opt->max_gap? qlen : opt->max_gap, opt->bw, opt->max_chain_skip, opt->max_chain_iter, opt->min_cnt, opt->min_chain_score, opt->chain_gap_scale, !!(opt->flag & MM_F_SPLICE), 1, n_a, a, &n_regs0, &u, b->km);
+	regs0 = mm_gen_regs(b->km, hash, qlen, n_regs0, u, a);
+	chain_post(opt, max_chain_gap_ref, mi, b->km, qlen, 1, &qlen, &n_regs0, regs0, a);
+	for (i = 0; i < n_regs0; ++i)
+		if (regs0[i].parent == regs0[i].id && (r == 0 || regs0[i].score > r->score))
+			r = &regs0[i];
+	if (r && r->qe - r->qs >= qlen * MM_UNIQUE_MIN_SPAN && r->subsc <= r->score * MM_UNIQUE_MAX_SUB) {
+		for (i = r->as + 1; i < r->as + r->cnt; ++i) {
+			int32_t dr = (int32_t)a[i].x - (int32_t)a[i-1].x, dq = (int32_t)a[i].y - (int32_t)a[i-1].y;
+			if (dr - dq > MM_UNIQUE_MAX_INDEL || dq - dr > MM_UNIQUE_MAX_INDEL) break;
+		}
+		is_unique = (i == r->as + r->cnt);
+	}
+
+	if (is_unique) {
+		b->frag_gap = max_chain_gap_ref;
+		b->rep_len = rep_len;
+		regs0 = align_regs(opt, mi, b->km, qlen, seq, &n_regs0, regs0, a);
+		mm_set_mapq(b->km, n_regs0, regs0, opt->min_chain_score, opt->a, rep_len, is_sr);
+		*n_regs = n_regs0, *regs = regs0;
+	} else {
+		for (i = 0; i < n_regs0; ++i) free(regs0[i].p);
+		free(regs0);
+	}
+	kfree(b->km, a);
+	kfree(b->km, u);
+	return is_unique;
+}
+
 void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **seqs, int *n_regs, mm_reg1_t **regs, mm_tbuf_t *b, const mm_mapopt_t *opt, const char *qname)
 {
 	int i, j, rep_len, qlen_sum, n_regs0, n_mini_pos;
@@ -286,7 +438,12 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 	mm128_t *a;
 	mm128_v mv = {0,0,0};
 	mm_reg1_t *regs0;
+	mm_sketch_cache_t skc;
+	mm_seed_cache_t shc;
+	const mm_seed_cache_t *sc0 = b->sc;
 	km_stat_t kmst;
+	int is_unique = 0, n_regs_u = 0;
+	mm_reg1_t *regs_u = 0;
 
 	//TODO: generalize this to n_segs > 1
 	assert (n_segs == 1);		//deal with long reads (or asm contigs) only
@@ -309,9 +466,26 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 	//create a boolean vector to indicate what portion of read were mapped using MCASs
 	int8_t* seqMapped = (int8_t *)kmalloc(b->km, qlens[0] * sizeof(int8_t));
 	memset(seqMapped, 0, qlens[0] * sizeof(int8_t));
+	memset(&skc, 0, sizeof(mm_sketch_cache_t));
+	memset(&shc, 0, sizeof(mm_seed_cache_t));
 
 	//check if SVaware mode enabled and query length is sufficient
 	if (opt_2->SVaware && qlens[0] >= opt_2->SVawareMinReadLength)
+	{
+		//sketch the read once; the minimizers of each substring are derived from it
+		mm_sketch_cache_init(b->km, seqs[0], qlens[0], mi->w, mi->k, mi->flag&MM_I_HPC, mi, &skc);
+		//look up its minimizers once too; substrings and stage 2 find their hits in this table
+		mm_seed_cache_build(b->km, mi, b->sc, std::max(opt->mid_occ, opt->max_occ), skc.mv.n, skc.mv.a, &shc);
+		b->sc = &shc;
+	}
+
+	//reads in unique sequence are mapped as on the default route, without the MCAS search
+	if (skc.len && (opt->flag & MM_F_FAST_UNIQUE))
+		is_unique = map_frag_unique(opt, mi, b, &skc, qlens[0], seqs[0], qname, &n_regs_u, &regs_u);
+	if ((mm_dbg_flag & MM_DBG_POLISH) && is_unique)
+		fprintf(stderr, "PO\tqname:%s, unique read, skipping MCAS search\n", qname);
+
+	if (skc.len && !is_unique)
 	{
 		//parallelize single read alignment further for better load balance
 #pragma omp parallel num_threads(OMP_PER_READ_THREADS)
@@ -326,9 +500,14 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 			mm_reg1_t *regs0;
 			mm_tbuf_t *b = (mm_tbuf_t*)calloc(1, sizeof(mm_tbuf_t)); //omp thread local buffer
 			b->km = km_init();
+			b->sc = b_master->sc;
 			int* sub_qlens = (int *)kmalloc(b->km, 1 * sizeof(int));
 			char **sub_seqs = (char **) kmalloc(b->km, 1 * sizeof(char*));
 			sub_seqs[0] = (char *)kmalloc(b->km, qlens[0] * sizeof(char));
+			mm_chain_inc_t inc[2], *inc_r = 0, *inc_l = 0; //chaining state of the windows growing to the right and to the left
+			memset(inc, 0, sizeof(inc));
+			inc[1].rev = 1;
+			if (opt_2->flag & MM_F_CHAIN_INC) inc_r = &inc[0], inc_l = &inc[1];
 
 #pragma omp for schedule(dynamic)
 			for (int sub_begin = 0; sub_begin < qlens[0] + opt_2->suffixSampleOffset - 1; sub_begin += opt_2->suffixSampleOffset)
@@ -339,6 +518,7 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 				int max_mapq_currentPos = 0;
 				if (sub_begin >= qlens[0]) sub_begin = qlens[0]-1; //for last iter
 				assert (sub_begin >= 0 && sub_begin < qlens[0]);
+				inc[0].n = inc[1].n = 0;
 
 				for (int sub_len = opt_2->minPrefixLength; sub_len <= opt_2->maxPrefixLength; sub_len *= opt_2->prefixIncrementFactor)
 				{
@@ -359,9 +539,9 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 						hash ^= __ac_Wang_hash(qlen_sum) + __ac_Wang_hash(opt_2->seed);
 						hash  = __ac_Wang_hash(hash);
 
-						collect_minimizers(b->km, opt_2, mi, n_segs, sub_qlens, sub_seqs, &mv);
-						if (opt_2->flag & MM_F_HEAP_SORT) a = collect_seed_hits_heap(b->km, opt_2, opt_2->mid_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
-						else a = collect_seed_hits(b->km, opt_2, opt_2->mid_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
+						collect_minimizers_sub(b->km, opt_2, mi, &skc, sub_begin, sub_len, &mv);
+						if (opt_2->flag & MM_F_HEAP_SORT) a = collect_seed_hits_heap(b->km, b->sc, opt_2, opt_2->mid_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
+						else a = collect_seed_hits(b->km, b->sc, opt_2, opt_2->mid_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
 
 						if (mm_dbg_flag & MM_DBG_PRINT_SEED) {
 							fprintf(stderr, "RS\t%d\n", rep_len);
@@ -386,7 +566,7 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 							min_chain_gap_ref = opt_2->min_gap_ref;
 						else min_chain_gap_ref = max_chain_gap_ref;
 
-						a = mm_chain_dp(max_chain_gap_ref, min_chain_gap_ref, max_chain_gap_qry, opt_2->bw, opt_2->max_chain_skip, opt_2->max_chain_iter, opt_2->min_cnt, opt_2->min_chain_score, opt->chain_gap_scale, is_splice, n_segs, n_a, a, &n_regs0, &u, b->km);
+						a = mm_chain_dp_inc(max_chain_gap_ref, min_chain_gap_ref, max_chain_gap_qry, opt_2->bw, opt_2->max_chain_skip, opt_2->max_chain_iter, opt_2->min_cnt, opt_2->min_chain_score, opt->chain_gap_scale, is_splice, n_segs, n_a, a, &n_regs0, &u, b->km, inc_r);
 
 						if (opt_2->max_occ > opt_2->mid_occ && rep_len > 0) {
 							int rechain = 0;
@@ -406,8 +586,8 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 								kfree(b->km, a);
 								kfree(b->km, u);
 								kfree(b->km, mini_pos);
-								if (opt_2->flag & MM_F_HEAP_SORT) a = collect_seed_hits_heap(b->km, opt_2, opt_2->max_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
-								else a = collect_seed_hits(b->km, opt_2, opt_2->max_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
+								if (opt_2->flag & MM_F_HEAP_SORT) a = collect_seed_hits_heap(b->km, b->sc, opt_2, opt_2->max_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
+								else a = collect_seed_hits(b->km, b->sc, opt_2, opt_2->max_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
 								a = mm_chain_dp(max_chain_gap_ref, min_chain_gap_ref, max_chain_gap_qry, opt_2->bw, opt_2->max_chain_skip, opt_2->max_chain_iter, opt_2->min_cnt, opt_2->min_chain_score, opt->chain_gap_scale, is_splice, n_segs, n_a, a, &n_regs0, &u, b->km);
 							}
 						}
@@ -425,8 +605,11 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 						chain_post(opt_2, max_chain_gap_ref, mi, b->km, qlen_sum, n_segs, qlens, &n_regs0, regs0, a);
 						if (!is_sr) mm_est_err(mi, qlen_sum, n_regs0, regs0, a, n_mini_pos, mini_pos);
 
+						int is_hopeless = 0; //ruled out from its chains alone; never accepted
 						if (n_segs == 1) { // uni-segment
-							regs0 = align_regs(opt_2, mi, b->km, sub_qlens[0], sub_seqs[0], &n_regs0, regs0, a);
+							if ((opt_2->flag & MM_F_CHAIN_MAPQ) && !stage1_may_pass(opt_2, b->km, n_regs0, regs0, rep_len, is_sr))
+								is_hopeless = 1;
+							else regs0 = align_regs(opt_2, mi, b->km, sub_qlens[0], sub_seqs[0], &n_regs0, regs0, a);
 							mm_set_mapq(b->km, n_regs0, regs0, opt_2->min_chain_score, opt_2->a, rep_len, is_sr);
 							n_regs[0] = n_regs0, regs[0] = regs0;
 						} else { // multi-segment
@@ -453,7 +636,7 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 							max_mapq_currentPos = std::max (max_mapq_fragment, max_mapq_currentPos);
 
 							//Check for high confidence (mapq), length
-							if (regs0[j].mapq >= opt_2->min_mapq && regs0[j].blen >= opt_2->min_qcov * sub_len && regs0[j].cnt > 0)
+							if (!is_hopeless && regs0[j].mapq >= opt_2->min_mapq && regs0[j].blen >= opt_2->min_qcov * sub_len && regs0[j].cnt > 0)
 							{
 								mappingFound = true;
 								mostPromisingMapping = j;
@@ -531,9 +714,9 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 						hash ^= __ac_Wang_hash(qlen_sum) + __ac_Wang_hash(opt_2->seed);
 						hash  = __ac_Wang_hash(hash);
 
-						collect_minimizers(b->km, opt_2, mi, n_segs, sub_qlens, sub_seqs, &mv);
-						if (opt_2->flag & MM_F_HEAP_SORT) a = collect_seed_hits_heap(b->km, opt_2, opt_2->mid_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
-						else a = collect_seed_hits(b->km, opt_2, opt_2->mid_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
+						collect_minimizers_sub(b->km, opt_2, mi, &skc, sub_begin - sub_len + 1, sub_len, &mv);
+						if (opt_2->flag & MM_F_HEAP_SORT) a = collect_seed_hits_heap(b->km, b->sc, opt_2, opt_2->mid_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
+						else a = collect_seed_hits(b->km, b->sc, opt_2, opt_2->mid_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
 
 						if (mm_dbg_flag & MM_DBG_PRINT_SEED) {
 							fprintf(stderr, "RS\t%d\n", rep_len);
@@ -558,7 +741,7 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 							min_chain_gap_ref = opt_2->min_gap_ref;
 						else min_chain_gap_ref = max_chain_gap_ref;
 
-						a = mm_chain_dp(max_chain_gap_ref, min_chain_gap_ref, max_chain_gap_qry, opt_2->bw, opt_2->max_chain_skip, opt_2->max_chain_iter, opt_2->min_cnt, opt_2->min_chain_score, opt->chain_gap_scale, is_splice, n_segs, n_a, a, &n_regs0, &u, b->km);
+						a = mm_chain_dp_inc(max_chain_gap_ref, min_chain_gap_ref, max_chain_gap_qry, opt_2->bw, opt_2->max_chain_skip, opt_2->max_chain_iter, opt_2->min_cnt, opt_2->min_chain_score, opt->chain_gap_scale, is_splice, n_segs, n_a, a, &n_regs0, &u, b->km, inc_l);
 
 						if (opt_2->max_occ > opt_2->mid_occ && rep_len > 0) {
 							int rechain = 0;
@@ -578,8 +761,8 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 								kfree(b->km, a);
 								kfree(b->km, u);
 								kfree(b->km, mini_pos);
-								if (opt_2->flag & MM_F_HEAP_SORT) a = collect_seed_hits_heap(b->km, opt_2, opt_2->max_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
-								else a = collect_seed_hits(b->km, opt_2, opt_2->max_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
+								if (opt_2->flag & MM_F_HEAP_SORT) a = collect_seed_hits_heap(b->km, b->sc, opt_2, opt_2->max_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
+								else a = collect_seed_hits(b->km, b->sc, opt_2, opt_2->max_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
 								a = mm_chain_dp(max_chain_gap_ref, min_chain_gap_ref, max_chain_gap_qry, opt_2->bw, opt_2->max_chain_skip, opt_2->max_chain_iter, opt_2->min_cnt, opt_2->min_chain_score, opt->chain_gap_scale, is_splice, n_segs, n_a, a, &n_regs0, &u, b->km);
 							}
 						}
@@ -597,8 +780,11 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 						chain_post(opt_2, max_chain_gap_ref, mi, b->km, qlen_sum, n_segs, qlens, &n_regs0, regs0, a);
 						if (!is_sr) mm_est_err(mi, qlen_sum, n_regs0, regs0, a, n_mini_pos, mini_pos);
 
+						int is_hopeless = 0; //ruled out from its chains alone; never accepted
 						if (n_segs == 1) { // uni-segment
-							regs0 = align_regs(opt_2, mi, b->km, sub_qlens[0], sub_seqs[0], &n_regs0, regs0, a);
+							if ((opt_2->flag & MM_F_CHAIN_MAPQ) && !stage1_may_pass(opt_2, b->km, n_regs0, regs0, rep_len, is_sr))
+								is_hopeless = 1;
+							else regs0 = align_regs(opt_2, mi, b->km, sub_qlens[0], sub_seqs[0], &n_regs0, regs0, a);
 							mm_set_mapq(b->km, n_regs0, regs0, opt_2->min_chain_score, opt_2->a, rep_len, is_sr);
 							n_regs[0] = n_regs0, regs[0] = regs0;
 						} else { // multi-segment
@@ -625,7 +811,7 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 							max_mapq_currentPos = std::max (max_mapq_fragment, max_mapq_currentPos);
 
 							//Check for high confidence (mapq), length
-							if (regs0[j].mapq >= opt_2->min_mapq && regs0[j].blen >= opt_2->min_qcov * sub_len && regs0[j].cnt > 0)
+							if (!is_hopeless && regs0[j].mapq >= opt_2->min_mapq && regs0[j].blen >= opt_2->min_qcov * sub_len && regs0[j].cnt > 0)
 							{
 								mappingFound = true;
 								mostPromisingMapping = j;
@@ -692,6 +878,8 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 			}
 
 			//free openmp thread specific memory
+			mm_chain_inc_free(b->km, &inc[0]);
+			mm_chain_inc_free(b->km, &inc[1]);
 			kfree(b->km, sub_qlens);
 			kfree(b->km, sub_seqs[0]);
 			kfree(b->km, sub_seqs);
@@ -721,15 +909,15 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 		for (i = 0, qlen_sum = 0; i < n_segs; ++i)
 			qlen_sum += qlens[i], n_regs[i] = 0, regs[i] = 0, n_regs0 = 0;
 
-		if (qlen_sum == 0 || n_segs <= 0 || n_segs > MM_MAX_SEG) return;
-		if (opt_3->max_qlen > 0 && qlen_sum > opt_3->max_qlen) return;
+		if (qlen_sum == 0 || n_segs <= 0 || n_segs > MM_MAX_SEG) goto end_map_frag;
+		if (opt_3->max_qlen > 0 && qlen_sum > opt_3->max_qlen) goto end_map_frag;
 
 		hash  = qname? __ac_X31_hash_string(qname) : 0;
 		hash ^= __ac_Wang_hash(qlen_sum) + __ac_Wang_hash(opt_3->seed);
 		hash  = __ac_Wang_hash(hash);
 
-		//Use anchors from our own analysis
-		n_a = 0;
+		//Use anchors from our own analysis; none of them came from repetitive minimizers
+		n_a = 0, rep_len = 0;
 		for (i = 0; i < countStartingPositions; i++)
 			n_a += collect_n_a[i];
 
@@ -808,9 +996,9 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 			collect_minimizers(b->km, opt_3, mi, n_segs, qlens, unmapped_seqs, &mv);
 
 			if (opt_3->flag & MM_F_HEAP_SORT)
-				a_remaining = collect_seed_hits_heap(b->km, opt_3, opt_3->mid_occ, mi, qname, &mv, qlen_sum, &n_a_remaining, &rep_len, &n_mini_pos, &mini_pos);
+				a_remaining = collect_seed_hits_heap(b->km, b->sc, opt_3, opt_3->mid_occ, mi, qname, &mv, qlen_sum, &n_a_remaining, &rep_len, &n_mini_pos, &mini_pos);
 			else
-				a_remaining = collect_seed_hits(b->km, opt_3, opt_3->mid_occ, mi, qname, &mv, qlen_sum, &n_a_remaining, &rep_len, &n_mini_pos, &mini_pos);
+				a_remaining = collect_seed_hits(b->km, b->sc, opt_3, opt_3->mid_occ, mi, qname, &mv, qlen_sum, &n_a_remaining, &rep_len, &n_mini_pos, &mini_pos);
 
 			kfree(b->km, mv.a);
 			kfree(b->km, mini_pos);
@@ -845,7 +1033,9 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 		}
 	}
 
-	{
+	if (is_unique)
+		n_regs[0] = n_regs_u, regs[0] = regs_u;
+	else {
 		if (!n_a) //MCAS-method couldn't be used
 		{
 			//go with the default route
@@ -856,9 +1046,10 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 			*opt_3 = *opt;
 
 			mv = {0,0,0};
-			collect_minimizers(b->km, opt_3, mi, n_segs, qlens, seqs, &mv);
-			if (opt_3->flag & MM_F_HEAP_SORT) a = collect_seed_hits_heap(b->km, opt_3, opt_3->mid_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
-			else a = collect_seed_hits(b->km, opt_3, opt_3->mid_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
+			if (skc.len) collect_minimizers_sub(b->km, opt_3, mi, &skc, 0, qlens[0], &mv);
+			else collect_minimizers(b->km, opt_3, mi, n_segs, qlens, seqs, &mv);
+			if (opt_3->flag & MM_F_HEAP_SORT) a = collect_seed_hits_heap(b->km, b->sc, opt_3, opt_3->mid_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
+			else a = collect_seed_hits(b->km, b->sc, opt_3, opt_3->mid_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
 
 			kfree(b->km, mv.a);
 			kfree(b->km, mini_pos);
@@ -908,8 +1099,8 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 				kfree(b->km, a);
 				kfree(b->km, u);
 				//kfree(b->km, mini_pos); //already freed above
-				if (opt_3->flag & MM_F_HEAP_SORT) a = collect_seed_hits_heap(b->km, opt_3, opt_3->max_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
-				else a = collect_seed_hits(b->km, opt_3, opt_3->max_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
+				if (opt_3->flag & MM_F_HEAP_SORT) a = collect_seed_hits_heap(b->km, b->sc, opt_3, opt_3->max_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
+				else a = collect_seed_hits(b->km, b->sc, opt_3, opt_3->max_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
 				a = mm_chain_dp(max_chain_gap_ref, min_chain_gap_ref, max_chain_gap_qry, opt_3->bw, opt_3->max_chain_skip, opt_3->max_chain_iter, opt_3->min_cnt, opt_3->min_chain_score, opt->chain_gap_scale, is_splice, n_segs, n_a, a, &n_regs0, &u, b->km);
 			}
 		}
@@ -953,6 +1144,7 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 		/*kfree(b->km, mv.a);*/
 	}
 
+end_map_frag:
 	for (i = 0; i < countStartingPositions; i++)
 		if (collect_n_a[i] > 0)
 			kfree(b->km, collect_a[i]);
@@ -960,6 +1152,9 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 	kfree(b->km, collect_a);
 	kfree(b->km, collect_n_a);
 	kfree(b->km, seqMapped);
+	mm_sketch_cache_destroy(b->km, &skc);
+	if (shc.h) mm_seed_cache_free(b->km, &shc);
+	b->sc = sc0;
 
 	if (b->km) {
 		km_stat(b->km, &kmst);
@@ -1003,14 +1198,17 @@ typedef struct {
 	int *n_reg, *seg_off, *n_seg, *rep_len, *frag_gap;
 	mm_reg1_t **reg;
 	mm_tbuf_t **buf;
+	int frag_off, seq_off;   // the group of fragments being mapped with --batch-seed
+	mm_seed_cache_t *sc;     // sc[i]: seed cache of read seq_off+i
 } step_t;
 
 static void worker_for(void *_data, long i, int tid) // kt_for() callback
 {
 	step_t *s = (step_t*)_data;
-	int qlens[MM_MAX_SEG], j, off = s->seg_off[i], pe_ori = s->p->opt->pe_ori;
+	int qlens[MM_MAX_SEG], j, off, pe_ori = s->p->opt->pe_ori;
 	const char *qseqs[MM_MAX_SEG];
 	mm_tbuf_t *b = s->buf[tid];
+	i += s->frag_off, off = s->seg_off[i];
 	assert(s->n_seg[i] <= MM_MAX_SEG);
 	if (mm_dbg_flag & MM_DBG_PRINT_QNAME)
 		fprintf(stderr, "QR\t%s\t%d\t%d\n", s->seq[off].name, tid, s->seq[off].l_seq);
@@ -1022,11 +1220,13 @@ static void worker_for(void *_data, long i, int tid) // kt_for() callback
 	}
 	if (s->p->opt->flag & MM_F_INDEPEND_SEG) {
 		for (j = 0; j < s->n_seg[i]; ++j) {
+			b->sc = s->sc? &s->sc[off + j - s->seq_off] : 0;
 			mm_map_frag(s->p->mi, 1, &qlens[j], &qseqs[j], &s->n_reg[off+j], &s->reg[off+j], b, s->p->opt, s->seq[off+j].name);
 			s->rep_len[off + j] = b->rep_len;
 			s->frag_gap[off + j] = b->frag_gap;
 		}
 	} else {
+		b->sc = s->sc? &s->sc[off - s->seq_off] : 0;
 		mm_map_frag(s->p->mi, s->n_seg[i], qlens, qseqs, &s->n_reg[off], &s->reg[off], b, s->p->opt, s->seq[off].name);
 		for (j = 0; j < s->n_seg[i]; ++j) {
 			s->rep_len[off + j] = b->rep_len;
@@ -1047,6 +1247,25 @@ static void worker_for(void *_data, long i, int tid) // kt_for() callback
 		}
 }
 
+static void map_batch_seed(step_t *s) // map fragments in groups of about MM_SEED_GROUP bases, seeding each group together
+{
+	const pipeline_t *p = s->p;
+	int st, en;
+	for (st = 0; st < s->n_frag; st = en) {
+		int64_t len = 0;
+		int j;
+		for (en = st; en < s->n_frag && len < MM_SEED_GROUP; ++en)
+			for (j = 0; j < s->n_seg[en]; ++j)
+				len += s->seq[s->seg_off[en] + j].l_seq;
+		s->frag_off = st, s->seq_off = s->seg_off[st];
+		j = s->seg_off[en - 1] + s->n_seg[en - 1] - s->seq_off; // number of reads in the group
+		s->sc = mm_seed_batch(p->mi, j, &s->seq[s->seq_off], p->n_threads);
+		kt_for(p->n_threads, worker_for, s, en - st);
+		mm_seed_cache_destroy(j, s->sc);
+	}
+	s->sc = 0, s->frag_off = s->seq_off = 0;
+}
+
 static void merge_hits(step_t *s)
 {
 	int f, i, k0, k, max_seg = 0, *n_reg_part, *rep_len_part, *frag_gap_part, *qlens;
@@ -1161,6 +1380,7 @@ static void *worker_pipeline(void *shared, int step, void *in)
 		} else free(s);
 	} else if (step == 1) { // step 1: map
 		if (p->n_parts > 0) merge_hits((step_t*)in);
+		else if (p->opt->flag & MM_F_BATCH_SEED) map_batch_seed((step_t*)in);
 		else kt_for(p->n_threads, worker_for, in, ((step_t*)in)->n_frag);
 		return in;
 	} else if (step == 2) { // step 2: output
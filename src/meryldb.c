@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mmpriv.h"
+
+#ifdef HAVE_MERYL
+#include "kthread.h"
+#include "kmers.H"
+
+using merylutil::kmers::v1::merylFileReader;
+using merylutil::kmers::v1::merylHistogram;
+
+typedef struct {
+	const char *dir;
+	int k;
+	uint64_t thres; // keep k-mers occurring more than $thres times
+	uint64_t **a, *n;
+} meryl_shared_t;
+
+static inline uint64_t meryl2nt4(uint64_t x, int k) // meryl encodes bases as A=0, C=1, T=2, G=3
+{
+	uint64_t y[2], shift1 = 2 * (k - 1);
+	int i;
+	x ^= (x >> 1) & 0x5555555555555555ULL; // swap T and G
+	y[0] = x, y[1] = 0;
+	for (i = 0; i < k; ++i, x >>= 2) // reverse complement
+		y[1] |= (3ULL ^ (x & 3)) << (shift1 - 2 * i);
+	return y[0] < y[1]? y[0] : y[1];
+}
+
+static void worker_meryl(void *g, long i, int tid) // read one of the files of a meryl database
+{
+	meryl_shared_t *d = (meryl_shared_t*)g;
+	merylFileReader *r = new merylFileReader(d->dir, (uint32)i);
+	uint64_t m = 0;
+	while (r->nextMer()) {
+		if (r->theValue() <= d->thres) continue;
+		if (d->n[i] == m) {
+			m = m? m<<1 : 1024;
+			d->a[i] = (uint64_t*)realloc(d->a[i], m * sizeof(uint64_t));
+		}
+		d->a[i][d->n[i]++] = meryl2nt4((uint64_t)(merylutil::kmers::v1::kmdata)r->theFMer(), d->k);
+	}
+	delete r;
+}
+
+static int meryl_thres(merylFileReader *r, const char *expr, uint64_t *thres)
+{
+	const char *v = strchr(expr, '=');
+	v = v? v + 1 : expr;
+	if (strncmp(expr, "distinct=", 9) == 0 || strncmp(expr, "d=", 2) == 0) { // as in "meryl print greater-than distinct=FRAC"
+		merylHistogram *h;
+		uint64_t i, n = 0, target;
+		char *p;
+		double frac = strtod(v, &p);
+		if (*p != 0 || !(frac > 0.0 && frac <= 1.0)) return -1;
+		h = r->stats();
+		target = (uint64_t)(frac * h->numDistinct());
+		*thres = 0;
+		for (i = 0; i < h->histogramLength(); ++i) {
+			n += h->histogramOccurrences(i);
+			if (n >= target) {
+				*thres = h->histogramValue(i);
+				break;
+			}
+		}
+	} else if (strncmp(expr, "threshold=", 10) == 0 || strncmp(expr, "t=", 2) == 0 || v == expr) {
+		char *p;
+		*thres = strtoull(v, &p, 10);
+		if (*p != 0) return -1;
+	} else return -1;
+	return 0;
+}
+
+int mm_meryl_load(const char *dir, int k, const char *expr, int n_threads, uint64_t ***a, uint64_t **n, uint64_t *thres)
+{
+	meryl_shared_t d;
+	merylFileReader *r;
+	int n_files;
+
+	r = new merylFileReader(dir);
+	if (r->theFMer().merSize() != (uint32)k) {
+		fprintf(stderr, "[ERROR]\033[1;31m meryl database '%s' has k=%u but winnowmap uses k=%d\033[0m\n", dir, r->theFMer().merSize(), k);
+		delete r;
+		return -1;
+	}
+	if (meryl_thres(r, expr, thres) < 0) {
+		fprintf(stderr, "[ERROR]\033[1;31m unrecognized meryl threshold '%s'; use distinct=FRAC with 0<FRAC<=1, or threshold=INT\033[0m\n", expr);
+		delete r;
+		return -1;
+	}
+	n_files = r->numFiles();
+	delete r;
+
+	d.dir = dir, d.k = k, d.thres = *thres;
+	d.a = (uint64_t**)calloc(n_files, sizeof(uint64_t*));
+	d.n = (uint64_t*)calloc(n_files, sizeof(uint64_t));
+	kt_for(n_threads, worker_meryl, &d, n_files);
+	*a = d.a, *n = d.n;
+	return n_files;
+}
+
+#else
+
+int mm_meryl_load(const char *dir, int k, const char *expr, int n_threads, uint64_t ***a, uint64_t **n, uint64_t *thres)
+{
+	fprintf(stderr, "[ERROR]\033[1;31m winnowmap was built without meryl; pass the k-mers of '%s' from \"meryl print greater-than\" to -W instead\033[0m\n", dir);
+	return -1;
+}
+
+#endif
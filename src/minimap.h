@@ -4,7 +4,6 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <sys/types.h>
-#include "../ext/bloom/bloom_filter.hpp"
 
 #define MM_F_NO_DIAG       0x001 // no exact diagonal hit
 #define MM_F_NO_DUAL       0x002 // skip pairs where query name is lexicographically larger than target name
@@ -37,12 +36,22 @@
 #define MM_F_NO_END_FLT    0x10000000
 #define MM_F_HARD_MLEVEL   0x20000000
 #define MM_F_SAM_HIT_ONLY  0x40000000
+#define MM_F_BATCH_SEED    0x80000000LL // look up the minimizers of a batch of reads together
+#define MM_F_CHAIN_INC     0x100000000LL // stage 1: reuse the chaining DP of the shorter window
+#define MM_F_CHAIN_MAPQ    0x200000000LL // stage 1: align only substrings whose chains may be confident
+#define MM_F_FAST_UNIQUE   0x400000000LL // skip stage 1 for reads in unique sequence
 
 #define MM_I_HPC          0x1
 #define MM_I_NO_SEQ       0x2
 #define MM_I_NO_NAME      0x4
+#define MM_I_EXACT_DOWN   0x8 // keep down-weighted k-mers in an exact set instead of a bloom filter
+#define MM_I_MMAP         0x10 // dump the index in the memory-mappable layout
+#define MM_I_POPULATE     0x20 // pre-fault a memory-mapped index when loading it
+#define MM_I_2BIT         0x40 // 2-bit packed sequence plus a table of ambiguous bases
+#define MM_I_PACK_POS     0x80 // compress the position lists of repetitive minimizers
 
-#define MM_IDX_MAGIC   "MMI\2"
+#define MM_IDX_MAGIC   "MMI\7"
+#define MM_IDX_MAGIC_MMAP "MMM\7"
 
 #define MM_MAX_SEG       255
 
@@ -69,10 +78,18 @@ typedef struct {
 	int32_t index;
 	int32_t n_alt;
 	mm_idx_seq_t *seq;         // sequence name, length and offset
-	uint32_t *S;               // 4-bit packed sequence
+	uint32_t *S;               // 4-bit packed sequence, or 2-bit with MM_I_2BIT
 	struct mm_idx_bucket_s *B; // index (hidden)
+	void *tab;                 // lookup tables of all buckets (hidden)
 	struct mm_idx_intv_s *I;   // intervals (hidden)
-	bloom_filter* downFilter;  // bloom filter for down-weighted kmers
+	struct mm_bloom_s *downFilter; // bloom filter for down-weighted kmers (hidden)
+	struct mm_kset_s *downSet;     // exact set of down-weighted kmers, used instead of downFilter (hidden)
+	uint64_t down_n, down_sum;     // number and order-independent checksum of the -W kmers
+	void *map; uint64_t map_len;   // memory-mapped image that B, S, names and the -W kmers point into, or 0
+	int32_t shm_fd; char *shm_name; // locked descriptor and name of the shared-memory segment holding _map_, or 0
+	uint64_t n_amb, *amb;          // with MM_I_2BIT: sorted runs [amb[2i],amb[2i+1]) of ambiguous bases in S
+	uint64_t n_occ, *occ;          // occurrence histogram: occ[2i+1] distinct minimizers occur occ[2i] times; ascending
+	int32_t occ_cap;               // minimizers occurring this many times or more have no positions, only a count; 0 if none
 	void *km, *h;
 } mm_idx_t;
 
@@ -106,6 +123,7 @@ typedef struct {
 typedef struct {
 	short k, w, flag, bucket_bits;
 	int mini_batch_size;
+	int occ_cap;     // keep no positions of minimizers occurring this many times or more; 0 to keep all
 	uint64_t batch_size;
 } mm_idxopt_t;
 
@@ -181,6 +199,8 @@ typedef struct {
 	int64_t idx_size;
 	mm_idxopt_t opt;
 	FILE *fp_out;
+	const char *shm;     // publish the index in, or attach to it from, this shared-memory segment (--idx-shm)
+	uint64_t target[4];  // device, inode, size and mtime of the input file, which --idx-shm jobs must agree on
 	union {
 		struct mm_bseq_file_s *seq;
 		FILE *idx;
@@ -241,6 +261,9 @@ mm_idx_reader_t *mm_idx_reader_open(const char *fn, const mm_idxopt_t *opt, cons
  * return an index for part of sequences. It needs to be repeatedly called
  * to traverse the entire index/sequence file.
  *
+ * With mm_idx_reader_t::shm set, the single-part index is instead taken from
+ * that shared-memory segment, which the first caller publishes it to.
+ *
  * @param r          index reader
  * @param n_threads  number of threads for constructing index
  *
@@ -287,6 +310,26 @@ mm_idx_t *mm_idx_load(FILE *fp);
  */
 void mm_idx_dump(FILE *fp, const mm_idx_t *mi);
 
+/**
+ * Append an index part in the memory-mappable layout
+ *
+ * mm_idx_reader_read() maps such a part and uses it in place instead of
+ * parsing it; see also MM_I_POPULATE.
+ *
+ * @param fp         pointer to FILE object
+ * @param mi         minimap2 index
+ */
+void mm_idx_dump_mmap(FILE *fp, const mm_idx_t *mi);
+
+/**
+ * Read an index file into the page cache
+ *
+ * @param fn         file name
+ *
+ * @return 0 on success; -1 if the file cannot be mapped
+ */
+int mm_idx_warm(const char *fn);
+
 /**
  * Create an index from strings in memory
  *
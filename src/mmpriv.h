@@ -22,12 +22,16 @@
 #define MM_SEED_SEG_SHIFT  48
 #define MM_SEED_SEG_MASK   (0xffULL<<(MM_SEED_SEG_SHIFT))
 
+#define MM_SKETCH_CKPT     512 // bases between the saved states of an mm_sketch_cache_t
+
 #ifndef kroundup32
 #define kroundup32(x) (--(x), (x)|=(x)>>1, (x)|=(x)>>2, (x)|=(x)>>4, (x)|=(x)>>8, (x)|=(x)>>16, ++(x))
 #endif
 
 #define mm_seq4_set(s, i, c) ((s)[(i)>>3] |= (uint32_t)(c) << (((i)&7)<<2))
 #define mm_seq4_get(s, i)    ((s)[(i)>>3] >> (((i)&7)<<2) & 0xf)
+#define mm_seq2_set(s, i, c) ((s)[(i)>>4] |= (uint32_t)(c) << (((i)&15)<<1))
+#define mm_seq2_get(s, i)    ((s)[(i)>>4] >> (((i)&15)<<1) & 3)
 
 #define MALLOC(type, len) ((type*)malloc((len) * sizeof(type)))
 #define CALLOC(type, len) ((type*)calloc((len), sizeof(type)))
@@ -50,6 +54,24 @@ typedef struct {
 	mm128_t *a;
 } mm_seg_t;
 
+typedef struct { // everything mm_sketch_range() needs to resume a scan
+	int i, l, kmer_span;      // next base to read; $l is capped at w+k
+	int tq_n, tq[32];         // homopolymer run lengths of the last k-mer
+	int n, min_age;           // number of slots in the window; slots since the current minimum
+	uint64_t kmer[2], min_order;
+	mm128_t min;
+	mm128_t buf[256];         // the last $n slots, oldest first
+	uint64_t order[256];
+} mm_sketch_state_t;
+
+typedef struct { // the sketch of a whole sequence, from which mm_sketch_sub() derives those of its substrings
+	const char *str;
+	int len, w, k, is_hpc, n_ckpt;
+	mm128_v mv;              // mm_sketch() of $str with rid 0
+	int *n_mv;               // n_mv[c]: number of minimizers in _mv_ reported before ckpt[c]
+	mm_sketch_state_t *ckpt; // ckpt[c]: scan state after reading bases [0,c*MM_SKETCH_CKPT)
+} mm_sketch_cache_t;
+
 double cputime(void);
 double realtime(void);
 long peakrss(void);
@@ -59,6 +81,14 @@ void radix_sort_64(uint64_t *beg, uint64_t *end);
 uint32_t ks_ksmall_uint32_t(size_t n, uint32_t arr[], size_t kk);
 
 void mm_sketch(void *km, const char *str, int len, int w, int k, uint32_t rid, int is_hpc, mm128_v *p, const mm_idx_t *mi);
+void mm_sketch_range(void *km, const char *str, int len, int beg, int st, int en, int w, int k, uint32_t rid, int is_hpc, mm128_v *p, const mm_idx_t *mi,
+					 const mm_sketch_state_t *in, mm_sketch_state_t *at_st, mm_sketch_state_t *at_en);
+int mm_sketch_state_eq(const mm_sketch_state_t *a, const mm_sketch_state_t *b);
+void mm_sketch_cache_init(void *km, const char *str, int len, int w, int k, int is_hpc, const mm_idx_t *mi, mm_sketch_cache_t *sc);
+void mm_sketch_cache_destroy(void *km, mm_sketch_cache_t *sc);
+void mm_sketch_sub(void *km, const mm_sketch_cache_t *sc, int st, int len, mm128_v *p, const mm_idx_t *mi);
+uint64_t mm_kmer_hash(uint64_t kmer, int k);
+int mm_meryl_load(const char *dir, int k, const char *expr, int n_threads, uint64_t ***a, uint64_t **n, uint64_t *thres);
 
 int mm_write_sam_hdr(const mm_idx_t *mi, const char *rg, const char *ver, int argc, char *argv[]);
 void mm_write_paf(kstring_t *s, const mm_idx_t *mi, const mm_bseq1_t *t, const mm_reg1_t *r, void *km, int opt_flag);
@@ -68,9 +98,83 @@ void mm_write_sam2(kstring_t *s, const mm_idx_t *mi, const mm_bseq1_t *t, int se
 void mm_write_sam3(kstring_t *s, const mm_idx_t *mi, const mm_bseq1_t *t, int seg_idx, int reg_idx, int n_seg, const int *n_regss, const mm_reg1_t *const* regss, void *km, int opt_flag, int rep_len);
 
 void mm_idxopt_init(mm_idxopt_t *opt);
-const uint64_t *mm_idx_get(const mm_idx_t *mi, uint64_t minier, int *n);
+const uint64_t *mm_idx_get(const mm_idx_t *mi, uint64_t minier, int *n, const uint8_t **z);
+void mm_idx_unpack_pos(const uint8_t *z, int n, uint64_t *a);
+
+/**
+ * Look up $n minimizers with mm_idx_get(), overlapping their cache misses
+ *
+ * @param cnt    numbers of occurrences (out)
+ * @param cr     positions (out)
+ * @param z      compressed positions (out)
+ */
+void mm_idx_get_batch(const mm_idx_t *mi, int n, const uint64_t *minier, int *cnt, const uint64_t **cr, const uint8_t **z);
+int mm_idx_is_amb(const mm_idx_t *mi, uint64_t o);
+
+// the hits of one minimizer of a read, looked up ahead of mapping by mm_seed_batch()
+typedef struct {
+	uint64_t x;          // minimizer; UINT64_MAX for an empty slot
+	int32_t n;           // as returned by mm_idx_get()
+	const uint64_t *cr;
+	const uint8_t *z;
+} mm_seed_ent_t;
+
+typedef struct {
+	int bits;            // the table has 1<<bits slots
+	mm_seed_ent_t *h;    // open addressing, linear probing
+	uint64_t *pos;       // positions decoded by mm_seed_cache_build(), or NULL
+} mm_seed_cache_t;
+
+/**
+ * Look up the minimizers of $n reads together, in index order
+ *
+ * @return per-read tables of the hits; to be freed by mm_seed_cache_destroy()
+ */
+mm_seed_cache_t *mm_seed_batch(const mm_idx_t *mi, int n, const mm_bseq1_t *seq, int n_threads);
+void mm_seed_cache_destroy(int n, mm_seed_cache_t *sc);
+
+/**
+ * Look up the $n minimizers $a of one read, for reuse across its substrings
+ *
+ * Hits are taken from $from if it has them. Compressed position lists shorter than $max_occ are
+ * decoded once; longer ones are never used.
+ */
+void mm_seed_cache_build(void *km, const mm_idx_t *mi, const mm_seed_cache_t *from, int max_occ, size_t n, const mm128_t *a, mm_seed_cache_t *sc);
+void mm_seed_cache_free(void *km, mm_seed_cache_t *sc);
+
+static inline uint32_t mm_seed_cache_home(const mm_seed_cache_t *sc, uint64_t x)
+{
+	return (uint32_t)(x * 0x9e3779b97f4a7c15ULL >> (64 - sc->bits));
+}
+
+static inline const mm_seed_ent_t *mm_seed_cache_get(const mm_seed_cache_t *sc, uint64_t x)
+{
+	uint32_t mask = (1U<<sc->bits) - 1, i = mm_seed_cache_home(sc, x);
+	for (; sc->h[i].x != UINT64_MAX; i = (i + 1) & mask)
+		if (sc->h[i].x == x) return &sc->h[i];
+	return 0;
+}
+
 int32_t mm_idx_cal_max_occ(const mm_idx_t *mi, float f);
 mm128_t *mm_chain_dp(int max_dist_x, int min_dist_x, int max_dist_y, int bw, int max_skip, int max_iter, int min_cnt, int min_sc, float gap_scale, int is_cdna, int n_segs, int64_t n, mm128_t *a, int *n_u_, uint64_t **_u, void *km);
+
+// DP state of the last mm_chain_dp_inc() call, for a stage-1 window that grows (--chain-inc)
+typedef struct {
+	int rev;             // strand whose query coordinates stay put as the window grows
+	int max_dist_x, max_dist_y;
+	int64_t n, m;
+	mm128_t *a;          // anchors in chaining order
+	int32_t *f, *p, *v;  // scores, predecessors and peak scores
+} mm_chain_inc_t;
+
+/**
+ * mm_chain_dp() reusing the DP state of the previous call with $inc
+ *
+ * Anchors on strand $inc->rev keep their scores if they lie before, on the query, all anchors added
+ * or dropped since that call. Set $inc->n to 0 to start over; NULL $inc is the same as mm_chain_dp().
+ */
+mm128_t *mm_chain_dp_inc(int max_dist_x, int min_dist_x, int max_dist_y, int bw, int max_skip, int max_iter, int min_cnt, int min_sc, float gap_scale, int is_cdna, int n_segs, int64_t n, mm128_t *a, int *n_u_, uint64_t **_u, void *km, mm_chain_inc_t *inc);
+void mm_chain_inc_free(void *km, mm_chain_inc_t *inc);
 mm_reg1_t *mm_align_skeleton(void *km, const mm_mapopt_t *opt, const mm_idx_t *mi, int qlen, const char *qstr, int *n_regs_, mm_reg1_t *regs, mm128_t *a);
 
 mm_reg1_t *mm_gen_regs(void *km, uint32_t hash, int qlen, int n_u, uint64_t *u, mm128_t *a);
@@ -105,4 +209,10 @@ void mm_err_fread(void *p, size_t size, size_t nitems, FILE *fp);
 }
 #endif
 
+static inline int mm_idx_base(const mm_idx_t *mi, uint64_t o) // nt4 code of base $o of the concatenated sequences
+{
+	if (!(mi->flag & MM_I_2BIT)) return mm_seq4_get(mi->S, o);
+	return mm_idx_is_amb(mi, o)? 4 : mm_seq2_get(mi->S, o);
+}
+
 #endif
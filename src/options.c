@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <climits>
+#include <cmath>
 #include "mmpriv.h"
 
 void mm_idxopt_init(mm_idxopt_t *opt)
@@ -76,6 +77,12 @@ void mm_mapopt_update(mm_mapopt_t *opt, const mm_idx_t *mi)
 		opt->mid_occ = mm_idx_cal_max_occ(mi, opt->mid_occ_frac);
 	if (opt->mid_occ < opt->min_mid_occ)
 		opt->mid_occ = opt->min_mid_occ;
+	if (mi->occ_cap > 0 && (opt->mid_occ > mi->occ_cap || opt->max_occ > mi->occ_cap)) {
+		int occ = opt->mid_occ > opt->max_occ? opt->mid_occ : opt->max_occ;
+		fprintf(stderr, "[ERROR]\033[1;31m the index has no positions of minimizers occurring %d or more times, but mapping uses minimizers occurring up to %d times; "
+				"rebuild it with --idx-max-occ %d or more, or filter more repetitive minimizers with -f FLOAT\033[0m\n", mi->occ_cap, occ, occ);
+		exit(1);
+	}
 	if (!opt->SVaware)
 		fprintf(stderr, "[M::%s::%.3f*%.2f] SV-aware mode = OFF, mid_occ = %d\n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), opt->mid_occ);
 }
@@ -137,6 +144,11 @@ int mm_check_opt(const mm_idxopt_t *io, const mm_mapopt_t *mo)
 			fprintf(stderr, "[ERROR]\033[1;31m --cs or --MD doesn't work with --split-prefix\033[0m\n");
 		return -6;
 	}
+	if (io->occ_cap < 0 || io->occ_cap == 1) {
+		if (mm_verbose >= 1)
+			fprintf(stderr, "[ERROR]\033[1;31m --idx-max-occ must be 0 or at least 2\033[0m\n");
+		return -5;
+	}
 	if (io->k <= 0 || io->w <= 0) {
 		if (mm_verbose >= 1)
 			fprintf(stderr, "[ERROR]\033[1;31m -k and -w must be positive\033[0m\n");
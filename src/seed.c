@@ -0,0 +1,180 @@
+#include <stdlib.h>
+#include <string.h>
+#include "kthread.h"
+#include "kvec.h"
+#include "kalloc.h"
+#include "mmpriv.h"
+
+/*
+ * Batch-level seeding (--batch-seed). The minimizers of all reads in a
+ * group are sketched and sorted by bucket and, within a bucket, by their
+ * home line in the bucket's table. They are then looked up in that order,
+ * so the index is swept instead of probed at random, each distinct
+ * minimizer once. The hits are scattered to a small hash table per read,
+ * which collect_matches() consults before the index.
+ */
+
+#define MM_SEED_SWEEP_CHUNK 0x10000 // distinct minimizers per lookup job
+#define MM_SEED_READ_BLOCK  16      // minimizers looked up together by mm_seed_cache_build()
+
+typedef struct {
+	const mm_idx_t *mi;
+	const mm_bseq1_t *seq;
+	mm128_v *mv;         // mv[i]: minimizers of read i
+	mm_seed_cache_t *sc;
+	mm128_t *a;          // (sort key, read) of all minimizers; the key is replaced by the index into _u_
+	int64_t *off;        // off[i]: start of read i in _a_
+	uint64_t *u;         // distinct minimizers, in sweep order
+	mm_seed_ent_t *r;    // r[j]: the hits of u[j]
+	int64_t n_u;
+} seed_batch_t;
+
+static inline uint64_t seed_sweep_key(const mm_idx_t *mi, uint64_t x) // bucket first, then the rest as in idx_home()
+{
+	return (x & ((1ULL<<mi->b) - 1)) << (mi->k * 2 - mi->b) | x >> mi->b;
+}
+
+static inline uint64_t seed_sweep_key_inv(const mm_idx_t *mi, uint64_t y)
+{
+	int shift = mi->k * 2 - mi->b;
+	return (y & ((1ULL<<shift) - 1)) << mi->b | y >> shift;
+}
+
+static void worker_seed_sketch(void *g, long i, int tid)
+{
+	seed_batch_t *d = (seed_batch_t*)g;
+	const mm_idx_t *mi = d->mi;
+	mm_seed_cache_t *sc = &d->sc[i];
+	mm_sketch(0, d->seq[i].seq, d->seq[i].l_seq, mi->w, mi->k, 0, mi->flag&MM_I_HPC, &d->mv[i], mi);
+	for (sc->bits = 4; 1ULL<<sc->bits < d->mv[i].n * 2; ++sc->bits);
+	sc->h = (mm_seed_ent_t*)malloc(sizeof(mm_seed_ent_t) << sc->bits);
+	memset(sc->h, 0xff, sizeof(mm_seed_ent_t) << sc->bits);
+}
+
+static void worker_seed_fill(void *g, long i, int tid)
+{
+	seed_batch_t *d = (seed_batch_t*)g;
+	mm128_t *a = &d->a[d->off[i]];
+	size_t j;
+	for (j = 0; j < d->mv[i].n; ++j)
+		a[j].x = seed_sweep_key(d->mi, d->mv[i].a[j].x>>8), a[j].y = i;
+	kfree(0, d->mv[i].a);
+}
+
+static void worker_seed_sweep(void *g, long i, int tid)
+{
+	seed_batch_t *d = (seed_batch_t*)g;
+	int64_t j, st = i * MM_SEED_SWEEP_CHUNK, en = st + MM_SEED_SWEEP_CHUNK < d->n_u? st + MM_SEED_SWEEP_CHUNK : d->n_u;
+	for (j = st; j < en; ++j) {
+		mm_seed_ent_t *r = &d->r[j];
+		r->x = seed_sweep_key_inv(d->mi, d->u[j]);
+		r->cr = mm_idx_get(d->mi, r->x, &r->n, &r->z);
+	}
+}
+
+static void seed_cache_put(mm_seed_cache_t *sc, const mm_seed_ent_t *r)
+{
+	uint32_t mask = (1U<<sc->bits) - 1, i = mm_seed_cache_home(sc, r->x);
+	for (; sc->h[i].x != UINT64_MAX; i = (i + 1) & mask)
+		if (sc->h[i].x == r->x) return; // a minimizer repeated in the read
+	sc->h[i] = *r;
+}
+
+mm_seed_cache_t *mm_seed_batch(const mm_idx_t *mi, int n, const mm_bseq1_t *seq, int n_threads)
+{
+	seed_batch_t d;
+	int64_t i, j, n_a = 0;
+
+	memset(&d, 0, sizeof(seed_batch_t));
+	d.mi = mi, d.seq = seq;
+	d.mv = (mm128_v*)calloc(n, sizeof(mm128_v));
+	d.sc = (mm_seed_cache_t*)calloc(n, sizeof(mm_seed_cache_t));
+	kt_for(n_threads, worker_seed_sketch, &d, n);
+
+	// gather the minimizers of all reads and sort them into sweep order
+	d.off = (int64_t*)malloc((n + 1) * sizeof(int64_t));
+	for (i = 0; i < n; ++i)
+		d.off[i] = n_a, n_a += d.mv[i].n;
+	d.off[n] = n_a;
+	d.a = (mm128_t*)malloc(n_a * sizeof(mm128_t));
+	kt_for(n_threads, worker_seed_fill, &d, n);
+	free(d.mv);
+	radix_sort_128x(d.a, d.a + n_a);
+	d.u = (uint64_t*)malloc(n_a * sizeof(uint64_t));
+	for (j = 0; j < n_a; ++j) {
+		if (d.n_u == 0 || d.a[j].x != d.u[d.n_u - 1])
+			d.u[d.n_u++] = d.a[j].x;
+		d.a[j].x = d.n_u - 1;
+	}
+
+	// look up each distinct minimizer once, then hand the hits to the reads
+	d.r = (mm_seed_ent_t*)malloc(d.n_u * sizeof(mm_seed_ent_t));
+	kt_for(n_threads, worker_seed_sweep, &d, (d.n_u + MM_SEED_SWEEP_CHUNK - 1) / MM_SEED_SWEEP_CHUNK);
+	for (j = 0; j < n_a; ++j)
+		seed_cache_put(&d.sc[d.a[j].y], &d.r[d.a[j].x]);
+	free(d.r); free(d.u); free(d.a); free(d.off);
+	return d.sc;
+}
+
+void mm_seed_cache_destroy(int n, mm_seed_cache_t *sc)
+{
+	int i;
+	if (sc == 0) return;
+	for (i = 0; i < n; ++i)
+		free(sc[i].h);
+	free(sc);
+}
+
+void mm_seed_cache_build(void *km, const mm_idx_t *mi, const mm_seed_cache_t *from, int max_occ, size_t n, const mm128_t *a, mm_seed_cache_t *sc)
+{
+	size_t i, j, n_u = 0, n_miss = 0, n_pos = 0, *miss;
+	uint64_t *u, *p;
+	mm_seed_ent_t *r;
+
+	// distinct minimizers of the read
+	u = (uint64_t*)kmalloc(km, n * sizeof(uint64_t));
+	for (i = 0; i < n; ++i)
+		u[i] = a[i].x >> 8;
+	radix_sort_64(u, u + n);
+	for (i = 0; i < n; ++i)
+		if (n_u == 0 || u[i] != u[n_u - 1])
+			u[n_u++] = u[i];
+
+	for (sc->bits = 4; 1ULL<<sc->bits < n_u * 2; ++sc->bits);
+	sc->h = (mm_seed_ent_t*)kmalloc(km, sizeof(mm_seed_ent_t) << sc->bits);
+	memset(sc->h, 0xff, sizeof(mm_seed_ent_t) << sc->bits);
+	r = (mm_seed_ent_t*)kmalloc(km, n_u * sizeof(mm_seed_ent_t));
+	miss = (size_t*)kmalloc(km, n_u * sizeof(size_t));
+	for (i = 0; i < n_u; ++i) { // take what the batch already has; move the rest to the front of _u_
+		const mm_seed_ent_t *e = from? mm_seed_cache_get(from, u[i]) : 0;
+		if (e) r[i] = *e;
+		else r[i].x = u[i], u[n_miss] = u[i], miss[n_miss++] = i;
+	}
+	for (i = 0; i < n_miss; i += MM_SEED_READ_BLOCK) { // look up the others in blocks, as collect_matches() does
+		int cnt[MM_SEED_READ_BLOCK], m = n_miss - i < MM_SEED_READ_BLOCK? n_miss - i : MM_SEED_READ_BLOCK;
+		const uint64_t *cr[MM_SEED_READ_BLOCK];
+		const uint8_t *z[MM_SEED_READ_BLOCK];
+		mm_idx_get_batch(mi, m, &u[i], cnt, cr, z);
+		for (j = 0; j < (size_t)m; ++j) {
+			mm_seed_ent_t *q = &r[miss[i + j]];
+			q->n = cnt[j], q->cr = cr[j], q->z = z[j];
+		}
+	}
+	for (i = 0; i < n_u; ++i)
+		if (r[i].z && r[i].n < max_occ) n_pos += r[i].n;
+	sc->pos = p = n_pos? (uint64_t*)kmalloc(km, n_pos * sizeof(uint64_t)) : 0;
+	for (i = 0; i < n_u; ++i) {
+		if (r[i].z && r[i].n < max_occ) { // decode once for all substrings
+			mm_idx_unpack_pos(r[i].z, r[i].n, p);
+			r[i].cr = p, r[i].z = 0, p += r[i].n;
+		}
+		seed_cache_put(sc, &r[i]);
+	}
+	kfree(km, r); kfree(km, u); kfree(km, miss);
+}
+
+void mm_seed_cache_free(void *km, mm_seed_cache_t *sc)
+{
+	kfree(km, sc->h); kfree(km, sc->pos);
+	memset(sc, 0, sizeof(mm_seed_cache_t));
+}
@@ -5,7 +5,8 @@
 #define __STDC_LIMIT_MACROS
 #include "kvec.h"
 #include "mmpriv.h"
-#include <cmath>
+#include "bloom.h"
+#include "kmerset.h"
 #include <iostream>
 #include <fstream>
 
@@ -62,30 +63,64 @@ static inline uint64_t hash64(uint64_t key, uint64_t mask)
 	return key;
 }
 
+/**
+ * hash64() of a 2-bit encoded k-mer; being invertible on 2k bits, it keys the
+ * exact down-weight set (mm_kset_t) without losing information
+ */
+uint64_t mm_kmer_hash(uint64_t kmer, int k)
+{
+	return hash64(kmer, (1ULL<<2*k) - 1);
+}
+
 /**
  * @brief		takes hash value of kmer and adjusts it based on kmer's weight
  *					this value will determine its order for minimizer selection
- * @details	this is inspired from Chum et al.'s min-Hash and tf-idf weighting 
+ * @details	this is inspired from Chum et al.'s min-Hash and tf-idf weighting;
+ *					with x = hash/2^64 in [0,1], the order is -x for regular k-mers
+ *					and -x^8 for down-weighted ones, both in double precision; the
+ *					bits of a non-negative double are monotone in its value, so
+ *					the order is encoded as an integer giving the same comparisons
+ *					and ties (smaller order wins)
+ * @param		x				murmerhash64() of the k-mer
+ * @param		is_down	whether the k-mer is in mm_idx_t::downFilter
  */
-static inline double applyWeight(uint64_t kmer, const mm_idx_t *mi)
+static inline uint64_t applyWeight(uint64_t x, int is_down)
 {
-	uint64_t hash = murmerhash64(kmer, UINT64_MAX);
-	double x = hash * 1.0 / UINT64_MAX;  //bring it within [0, 1]
-	//assert (x >= 0.0 && x <= 1.0);
-
-	if (mi->downFilter->contains(kmer))
+	double v = x * 1.0 / UINT64_MAX; //bring it within [0, 1]; exact scaling, as UINT64_MAX converts to 2^64
+	uint64_t bits;
+	if (is_down)
 	{
 		/* downweigting by a factor of 8 */
 		/* further aggressive downweigting may affect accuracy */
 		/* TODO: Consider making it a user parameter */
-		double p2 = x*x;
+		double p2 = v * v;
 		double p4 = p2 * p2;
-		return -1.0 * (p4 * p4);
+		v = p4 * p4;
 	}
-	return -1.0 * x;
+	//range of returned value is [0, 2^63); UINT64_MAX is reserved for
+	//uninitialized slots so that any valid k-mer beats them
+	memcpy(&bits, &v, sizeof(double));
+	return (uint64_t)INT64_MAX - bits;
+}
+
+#ifdef KSW_CPU_DISPATCH
+static int sketch_simd = -1;
+#endif
 
-	//range of returned value is between [-1,0]
-	//we avoid adding one for better double precision 
+/**
+ * Compute hash64() and murmerhash64() for a batch of k-mers; the bulk of the
+ * batch goes to the AVX2 kernel in sketch_avx2.c when the CPU supports it
+ */
+static void hash_kmers(int n, const uint64_t *kmer, uint64_t mask, uint64_t *hash, uint64_t *rank)
+{
+	int j = 0;
+#ifdef KSW_CPU_DISPATCH
+	extern int mm_sketch_hash_avx2(int n, const uint64_t *kmer, uint64_t mask, uint64_t *hash, uint64_t *rank);
+	if (sketch_simd < 0) sketch_simd = __builtin_cpu_supports("avx2")? 1 : 0;
+	if (sketch_simd) j = mm_sketch_hash_avx2(n, kmer, mask, hash, rank);
+#endif
+	for (; j < n; ++j)
+		hash[j] = hash64(kmer[j], mask), rank[j] = murmerhash64(kmer[j], UINT64_MAX);
 }
 
 typedef struct { // a simplified version of kdq
@@ -108,6 +143,42 @@ static inline int tq_shift(tiny_queue_t *q)
 	return x;
 }
 
+#define SKETCH_BLOCK 256
+
+typedef struct { // k-mers of a block of bases, rolled but not yet pushed to the window
+	uint64_t kmer[SKETCH_BLOCK], hash[SKETCH_BLOCK], rank[SKETCH_BLOCK], order[SKETCH_BLOCK];
+	uint64_t y[SKETCH_BLOCK]; // UINT64_MAX if the slot holds no valid k-mer
+	int l[SKETCH_BLOCK], span[SKETCH_BLOCK];
+} kmer_block_t;
+
+static void sketch_save(mm_sketch_state_t *s, int w, int k, int i, int l, const uint64_t kmer[2], int kmer_span, const tiny_queue_t *tq,
+						int t, const mm128_t *buf, const uint64_t *buf_order, mm128_t min, uint64_t min_order, int min_t)
+{
+	int u;
+	s->i = i, s->l = l < w + k? l : w + k, s->kmer_span = kmer_span; // beyond w+k, $l no longer affects the output
+	s->kmer[0] = kmer[0], s->kmer[1] = kmer[1];
+	for (u = 0, s->tq_n = tq->count; u < tq->count; ++u)
+		s->tq[u] = tq->a[(tq->front + u) & 0x1f];
+	s->n = t < w? t : w;
+	for (u = 0; u < s->n; ++u)
+		s->buf[u] = buf[(t - s->n + u)&0xff], s->order[u] = buf_order[(t - s->n + u)&0xff];
+	s->min = min, s->min_order = min_order, s->min_age = t - min_t;
+}
+
+int mm_sketch_state_eq(const mm_sketch_state_t *a, const mm_sketch_state_t *b)
+{
+	int u;
+	if (a->i != b->i || a->l != b->l || a->kmer_span != b->kmer_span || a->kmer[0] != b->kmer[0] || a->kmer[1] != b->kmer[1])
+		return 0;
+	if (a->tq_n != b->tq_n || a->n != b->n || a->min_age != b->min_age || a->min_order != b->min_order || a->min.x != b->min.x || a->min.y != b->min.y)
+		return 0;
+	for (u = 0; u < a->tq_n; ++u)
+		if (a->tq[u] != b->tq[u]) return 0;
+	for (u = 0; u < a->n; ++u)
+		if (a->order[u] != b->order[u] || a->buf[u].x != b->buf[u].x || a->buf[u].y != b->buf[u].y) return 0;
+	return 1;
+}
+
 /**
  * Find symmetric (w,k)-minimizers on a DNA sequence
  *
@@ -126,86 +197,158 @@ static inline int tq_shift(tiny_queue_t *q)
  *               Callers may want to set "p->n = 0"; otherwise results are appended to p
  */
 void mm_sketch(void *km, const char *str, int len, int w, int k, uint32_t rid, int is_hpc, mm128_v *p, const mm_idx_t *mi)
+{
+	mm_sketch_range(km, str, len, 0, 0, len, w, k, rid, is_hpc, p, mi, 0, 0, 0);
+}
+
+/**
+ * Find the minimizers of $str that mm_sketch() reports while reading bases [$st,$en)
+ *
+ * Reading starts at base $beg with an empty window, or where $in was saved if $in is not NULL. In the
+ * former case, the first bases before $st only warm up the window. The scan state right before $st
+ * and at the end is saved to $at_st and $at_en if they are not NULL. Two scans with equal states
+ * report the same minimizers from then on, so a long sequence can be sketched in pieces: a piece
+ * whose $at_st differs from the $at_en of the previous piece is redone from the latter.
+ */
+void mm_sketch_range(void *km, const char *str, int len, int beg, int st, int en, int w, int k, uint32_t rid, int is_hpc, mm128_v *p, const mm_idx_t *mi,
+					 const mm_sketch_state_t *in, mm_sketch_state_t *at_st, mm_sketch_state_t *at_en)
 {
 #if WRITE_MINIMIZERS_TO_FILE 
 	std::ofstream outFile ("minimizers.txt", std::ofstream::out | std::ofstream::app);
 #endif
 
 	uint64_t shift1 = 2 * (k - 1), mask = (1ULL<<2*k) - 1, kmer[2] = {0,0};
-	int i, j, l, buf_pos, min_pos, kmer_span = 0;
+	int i, j, n, l, t, u, min_t, scan_t, pre_t, kmer_span = 0;
+	int suf_t[256];            // suf_t[s&0xff]: slot of the closest minimum among slots [s, scan_t]
 	mm128_t buf[256], min = { UINT64_MAX, UINT64_MAX };
-	double buf_order[256], min_order = 2.0;    //2.0 value is indicating uninitialized
+	uint64_t buf_order[256], min_order = UINT64_MAX;    //UINT64_MAX value is indicating uninitialized
 	tiny_queue_t tq;
+	kmer_block_t kb;
 
 	assert(len > 0 && (w > 0 && w < 256) && (k > 0 && k <= 28)); // 56 bits for k-mer; could use long k-mers, but 28 enough in practice
-	memset(buf, 0xff, w * 16);
-	for(i=0; i<w; i++) buf_order[i] = 2.0;
 	memset(&tq, 0, sizeof(tiny_queue_t));
-	kv_resize(mm128_t, km, *p, p->n + len/w);
-
-	for (i = l = buf_pos = min_pos = 0; i < len; ++i) {
-		int c = seq_nt4_table[(uint8_t)str[i]];
-		mm128_t info = { UINT64_MAX, UINT64_MAX };
-		double info_order = 2.0; //2.0 value is indicating uninitialized
-		if (c < 4) { // not an ambiguous base
-			int z;
-			if (is_hpc) {
-				int skip_len = 1;
-				if (i + 1 < len && seq_nt4_table[(uint8_t)str[i + 1]] == c) {
-					for (skip_len = 2; i + skip_len < len; ++skip_len)
-						if (seq_nt4_table[(uint8_t)str[i + skip_len]] != c)
-							break;
-					i += skip_len - 1; // put $i at the end of the current homopolymer run
+	i = beg, l = t = 0, min_t = -w, scan_t = INT32_MIN, pre_t = -1;
+	if (in) { // resume; the restored window has not been scanned
+		i = in->i, l = in->l, kmer_span = in->kmer_span, kmer[0] = in->kmer[0], kmer[1] = in->kmer[1];
+		for (u = 0; u < in->tq_n; ++u) tq_push(&tq, in->tq[u]);
+		for (t = 0; t < in->n; ++t) {
+			buf[t] = in->buf[t], buf_order[t] = in->order[t];
+			if (pre_t < 0 || buf_order[t] <= buf_order[pre_t]) pre_t = t;
+		}
+		min = in->min, min_order = in->min_order, min_t = t - in->min_age;
+	}
+	kv_resize(mm128_t, km, *p, p->n + (en > i? en - i : 0)/w);
+	if (at_st && i >= st)
+		sketch_save(at_st, w, k, i, l, kmer, kmer_span, &tq, t, buf, buf_order, min, min_order, min_t);
+
+	/* Slot $t is the t-th k-mer pushed to the window and is kept at buf[t&0xff]. When the current minimum
+	 * leaves the window, the new one is the better of suf_t[], filled by the last full scan at slot $scan_t,
+	 * and $pre_t, the closest minimum pushed after $scan_t. A full scan is only needed once the window no
+	 * longer overlaps the previous one, so each k-mer costs amortized O(1) even in low-complexity regions. */
+	while (i < en) {
+		int emit = i >= st, stop = emit? en : st; // a block never crosses $st
+
+		// stage 1: roll k-mers for a block of bases
+		for (n = 0; n < SKETCH_BLOCK && i < stop; ++i) {
+			int c = seq_nt4_table[(uint8_t)str[i]];
+			kb.kmer[n] = 0, kb.span[n] = 0, kb.y[n] = UINT64_MAX;
+			if (c < 4) { // not an ambiguous base
+				int z;
+				if (is_hpc) {
+					int skip_len = 1;
+					if (i + 1 < len && seq_nt4_table[(uint8_t)str[i + 1]] == c) {
+						for (skip_len = 2; i + skip_len < len; ++skip_len)
+							if (seq_nt4_table[(uint8_t)str[i + skip_len]] != c)
+								break;
+						i += skip_len - 1; // put $i at the end of the current homopolymer run
+					}
+					tq_push(&tq, skip_len);
+					kmer_span += skip_len;
+					if (tq.count > k) kmer_span -= tq_shift(&tq);
+				} else kmer_span = l + 1 < k? l + 1 : k;
+				kmer[0] = (kmer[0] << 2 | c) & mask;           // forward k-mer
+				kmer[1] = (kmer[1] >> 2) | (3ULL^c) << shift1; // reverse k-mer
+				if (kmer[0] == kmer[1]) continue; // skip "symmetric k-mers" as we don't know it strand
+				z = kmer[0] < kmer[1]? 0 : 1; // strand
+				++l;
+				if (l >= k && kmer_span < 256) {
+					kb.kmer[n] = kmer[z], kb.span[n] = kmer_span;
+					kb.y[n] = (uint64_t)rid<<32 | (uint32_t)i<<1 | z;
 				}
-				tq_push(&tq, skip_len);
-				kmer_span += skip_len;
-				if (tq.count > k) kmer_span -= tq_shift(&tq);
-			} else kmer_span = l + 1 < k? l + 1 : k;
-			kmer[0] = (kmer[0] << 2 | c) & mask;           // forward k-mer
-			kmer[1] = (kmer[1] >> 2) | (3ULL^c) << shift1; // reverse k-mer
-			if (kmer[0] == kmer[1]) continue; // skip "symmetric k-mers" as we don't know it strand
-			z = kmer[0] < kmer[1]? 0 : 1; // strand
-			++l;
-			if (l >= k && kmer_span < 256) {
-				uint64_t hash_val = hash64(kmer[z], mask);
-				info.x = hash_val << 8 | kmer_span;
-				info.y = (uint64_t)rid<<32 | (uint32_t)i<<1 | z;
-				info_order = applyWeight(kmer[z], mi);
-			}
-		} else l = 0, tq.count = tq.front = 0, kmer_span = 0;
-		buf[buf_pos] = info; // need to do this here as appropriate buf_pos and buf[buf_pos] are needed below
-		buf_order[buf_pos] = info_order;
-
-		//tie-break criteria is using the "robust-winnowing" idea from [Schleimer et al. 2003]
-		if (info_order < min_order) // a new minimum; then write the old min
-		{
-			if (l >= w + k && min.x != UINT64_MAX) 
+			} else l = 0, tq.count = tq.front = 0, kmer_span = 0;
+			kb.l[n++] = l;
+		}
+
+		// stage 2: hash the block, possibly with SIMD
+		hash_kmers(n, kb.kmer, mask, kb.hash, kb.rank);
+
+		// stage 3: resolve the weight of each k-mer
+		if (mi->downSet) {
+			for (j = 0; j < n; ++j)
+				if (kb.y[j] != UINT64_MAX) mm_kset_prefetch(mi->downSet, kb.hash[j]);
+			for (j = 0; j < n; ++j)
+				kb.order[j] = kb.y[j] == UINT64_MAX? UINT64_MAX : applyWeight(kb.rank[j], mm_kset_contains(mi->downSet, kb.hash[j]));
+		} else if (mi->downFilter) {
+			for (j = 0; j < n; ++j) // the block fits in L1, so touch every filter line before probing
+				if (kb.y[j] != UINT64_MAX) mm_bloom_prefetch(mi->downFilter, kb.kmer[j]);
+			for (j = 0; j < n; ++j)
+				kb.order[j] = kb.y[j] == UINT64_MAX? UINT64_MAX : applyWeight(kb.rank[j], mm_bloom_contains(mi->downFilter, kb.kmer[j]));
+		} else {
+			for (j = 0; j < n; ++j)
+				kb.order[j] = kb.y[j] == UINT64_MAX? UINT64_MAX : applyWeight(kb.rank[j], 0);
+		}
+
+		// stage 4: push the block to the window
+		for (j = 0; j < n; ++j, ++t) {
+			mm128_t info = { UINT64_MAX, UINT64_MAX };
+			uint64_t info_order = kb.order[j];
+			l = kb.l[j];
+			if (kb.y[j] != UINT64_MAX)
+				info.x = kb.hash[j] << 8 | kb.span[j], info.y = kb.y[j];
+			buf[t&0xff] = info; // need to do this here as appropriate buf[t&0xff] is needed below
+			buf_order[t&0xff] = info_order;
+			if (pre_t < 0 || info_order <= buf_order[pre_t&0xff]) pre_t = t; // <= as min is always the closest k-mer
+
+			//tie-break criteria is using the "robust-winnowing" idea from [Schleimer et al. 2003]
+			if (info_order < min_order) // a new minimum; then write the old min
 			{
+				if (emit && l >= w + k && min.x != UINT64_MAX) 
+				{
 #if WRITE_MINIMIZERS_TO_FILE 
-				outFile << (uint32_t)(min.y >> 32) << "\t" << ((uint32_t)min.y >> 1) << "\t" << (uint64_t)(min.x >> 8) << "\n";
+					outFile << (uint32_t)(min.y >> 32) << "\t" << ((uint32_t)min.y >> 1) << "\t" << (uint64_t)(min.x >> 8) << "\n";
 #endif
-				kv_push(mm128_t, km, *p, min);
-			}
-			min = info, min_pos = buf_pos, min_order = info_order;
-		} 
-		else if (buf_pos == min_pos) // old min has moved outside the window
-		{
-			if (l >= w + k - 1 && min.x != UINT64_MAX) 
+					kv_push(mm128_t, km, *p, min);
+				}
+				min = info, min_t = t, min_order = info_order;
+			} 
+			else if (min_t == t - w) // old min has moved outside the window
 			{
+				if (emit && l >= w + k - 1 && min.x != UINT64_MAX) 
+				{
 #if WRITE_MINIMIZERS_TO_FILE 
-				outFile << (uint32_t)(min.y >> 32) << "\t" << ((uint32_t)min.y >> 1) << "\t" << (uint64_t)(min.x >> 8) << "\n";
+					outFile << (uint32_t)(min.y >> 32) << "\t" << ((uint32_t)min.y >> 1) << "\t" << (uint64_t)(min.x >> 8) << "\n";
 #endif
-				kv_push(mm128_t, km, *p, min);
+					kv_push(mm128_t, km, *p, min);
+				}
+				if (scan_t > t - w) { // the window still overlaps the last scan
+					min_t = suf_t[(t - w + 1)&0xff];
+					if (buf_order[pre_t&0xff] <= buf_order[min_t&0xff]) min_t = pre_t;
+				} else { // scan the window backwards; slots before 0 are never better than slot 0
+					for (u = t, min_t = t; u > t - w && u >= 0; --u) {
+						if (buf_order[u&0xff] < buf_order[min_t&0xff]) min_t = u; // < is important s.t. min is always the closest k-mer
+						suf_t[u&0xff] = min_t;
+					}
+					scan_t = t, pre_t = -1;
+				}
+				min = buf[min_t&0xff], min_order = buf_order[min_t&0xff];
 			}
-			// the two loops are necessary when there are identical k-mers
-			for (j = buf_pos + 1, min.x = UINT64_MAX, min_order = 2.0; j < w; ++j) 
-				if (min_order >= buf_order[j]) min = buf[j], min_pos = j, min_order = buf_order[j]; // >= is important s.t. min is always the closest k-mer
-			for (j = 0; j <= buf_pos; ++j)
-				if (min_order >= buf_order[j]) min = buf[j], min_pos = j, min_order = buf_order[j];
 		}
-		if (++buf_pos == w) buf_pos = 0;
+		if (at_st && !emit && i >= st)
+			sketch_save(at_st, w, k, i, l, kmer, kmer_span, &tq, t, buf, buf_order, min, min_order, min_t);
 	}
-	if (min.x != UINT64_MAX)
+	if (at_en)
+		sketch_save(at_en, w, k, i, l, kmer, kmer_span, &tq, t, buf, buf_order, min, min_order, min_t);
+	if (en >= len && min.x != UINT64_MAX)
 	{
 #if WRITE_MINIMIZERS_TO_FILE 
 		outFile << (uint32_t)(min.y >> 32) << "\t" << ((uint32_t)min.y >> 1) << "\t" << (uint64_t)(min.x >> 8) << "\n";
@@ -217,3 +360,69 @@ void mm_sketch(void *km, const char *str, int len, int w, int k, uint32_t rid, i
 	outFile.close();
 #endif
 }
+
+/**
+ * Sketch $str once for mm_sketch_sub(), saving the scan state every MM_SKETCH_CKPT bases
+ */
+void mm_sketch_cache_init(void *km, const char *str, int len, int w, int k, int is_hpc, const mm_idx_t *mi, mm_sketch_cache_t *sc)
+{
+	int c;
+	memset(sc, 0, sizeof(mm_sketch_cache_t));
+	sc->str = str, sc->len = len, sc->w = w, sc->k = k, sc->is_hpc = is_hpc;
+	sc->n_ckpt = (len + MM_SKETCH_CKPT - 1) / MM_SKETCH_CKPT;
+	sc->n_mv = (int*)kmalloc(km, sc->n_ckpt * sizeof(int));
+	sc->ckpt = (mm_sketch_state_t*)kmalloc(km, sc->n_ckpt * sizeof(mm_sketch_state_t));
+	for (c = 0; c < sc->n_ckpt; ++c) { // read bases [c*MM_SKETCH_CKPT,(c+1)*MM_SKETCH_CKPT), resuming from ckpt[c]
+		int st = c * MM_SKETCH_CKPT, en = st + MM_SKETCH_CKPT < len? st + MM_SKETCH_CKPT : len;
+		sc->n_mv[c] = sc->mv.n;
+		mm_sketch_range(km, str, len, 0, st, en, w, k, 0, is_hpc, &sc->mv, mi, c? &sc->ckpt[c] : 0, c? 0 : &sc->ckpt[0], c + 1 < sc->n_ckpt? &sc->ckpt[c+1] : 0);
+	}
+}
+
+void mm_sketch_cache_destroy(void *km, mm_sketch_cache_t *sc)
+{
+	kfree(km, sc->mv.a); kfree(km, sc->n_mv); kfree(km, sc->ckpt);
+	memset(sc, 0, sizeof(mm_sketch_cache_t));
+}
+
+/**
+ * Append to $p what mm_sketch() reports for the substring [$st,$st+$len) of the sequence cached in $sc
+ *
+ * The substring is scanned from an empty window only until its scan state equals the whole sequence's
+ * at a checkpoint; from there on the two scans agree, so the cached minimizers are copied up to the last
+ * checkpoint not influenced by bases past the substring, and the scan resumes there for the rest.
+ * Positions are relative to $st, as if the substring had been sketched on its own.
+ */
+void mm_sketch_sub(void *km, const mm_sketch_cache_t *sc, int st, int len, mm128_v *p, const mm_idx_t *mi)
+{
+	int c, e, pos = st, en = st + len, conv = 0;
+	size_t j, n0 = p->n;
+	mm_sketch_state_t s;
+
+	assert(st >= 0 && len > 0 && en <= sc->len);
+	if (st == 0 && en == sc->len) { // the whole sequence
+		kv_resize(mm128_t, km, *p, p->n + sc->mv.n);
+		memcpy(&p->a[p->n], sc->mv.a, sc->mv.n * sizeof(mm128_t));
+		p->n += sc->mv.n;
+		return;
+	}
+	// scan the head of the substring until it converges with the whole sequence; the state of a
+	// checkpoint past $en cannot be used, as the whole-sequence scan peeked beyond the substring
+	for (c = st / MM_SKETCH_CKPT + 1; c < sc->n_ckpt && c * MM_SKETCH_CKPT < en && sc->ckpt[c].i <= en; ++c) {
+		mm_sketch_range(km, sc->str, en, st, pos, c * MM_SKETCH_CKPT, sc->w, sc->k, 0, sc->is_hpc, p, mi, pos > st? &s : 0, 0, &s);
+		pos = c * MM_SKETCH_CKPT;
+		if (mm_sketch_state_eq(&s, &sc->ckpt[c])) {
+			conv = 1;
+			break;
+		}
+	}
+	if (conv) { // copy the cached minimizers, then finish from the last usable checkpoint
+		for (e = c; e + 1 < sc->n_ckpt && sc->ckpt[e+1].i <= en; ++e);
+		kv_resize(mm128_t, km, *p, p->n + (sc->n_mv[e] - sc->n_mv[c]));
+		memcpy(&p->a[p->n], &sc->mv.a[sc->n_mv[c]], (sc->n_mv[e] - sc->n_mv[c]) * sizeof(mm128_t));
+		p->n += sc->n_mv[e] - sc->n_mv[c];
+		mm_sketch_range(km, sc->str, en, st, e * MM_SKETCH_CKPT, en, sc->w, sc->k, 0, sc->is_hpc, p, mi, &sc->ckpt[e], 0, 0);
+	} else mm_sketch_range(km, sc->str, en, st, pos, en, sc->w, sc->k, 0, sc->is_hpc, p, mi, pos > st? &s : 0, 0, 0);
+	for (j = n0; j < p->n; ++j)
+		p->a[j].y -= (uint64_t)st << 1;
+}
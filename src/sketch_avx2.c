@@ -0,0 +1,45 @@
+#ifdef KSW_CPU_DISPATCH
+#include <stdint.h>
+#include <immintrin.h>
+
+static inline __m256i mm256_mullo_epi64(__m256i a, __m256i b) // AVX2 has no 64-bit low multiply
+{
+	__m256i lo = _mm256_mul_epu32(a, b);
+	__m256i t1 = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b);
+	__m256i t2 = _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32));
+	return _mm256_add_epi64(lo, _mm256_slli_epi64(_mm256_add_epi64(t1, t2), 32));
+}
+
+/**
+ * Vectorized hash64() and murmerhash64() from sketch.c, four k-mers at a time
+ *
+ * @return the number of k-mers hashed; the caller finishes the remaining (<4) ones
+ */
+int mm_sketch_hash_avx2(int n, const uint64_t *kmer, uint64_t mask, uint64_t *hash, uint64_t *rank)
+{
+	int i;
+	__m256i m = _mm256_set1_epi64x(mask), ones = _mm256_set1_epi64x(-1);
+	__m256i c1 = _mm256_set1_epi64x(0xff51afd7ed558ccdULL), c2 = _mm256_set1_epi64x(0xc4ceb9fe1a85ec53ULL);
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m256i k, h, r;
+		k = _mm256_loadu_si256((const __m256i*)&kmer[i]);
+		// hash64()
+		h = _mm256_and_si256(_mm256_add_epi64(_mm256_xor_si256(k, ones), _mm256_slli_epi64(k, 21)), m);
+		h = _mm256_xor_si256(h, _mm256_srli_epi64(h, 24));
+		h = _mm256_and_si256(_mm256_add_epi64(_mm256_add_epi64(h, _mm256_slli_epi64(h, 3)), _mm256_slli_epi64(h, 8)), m);
+		h = _mm256_xor_si256(h, _mm256_srli_epi64(h, 14));
+		h = _mm256_and_si256(_mm256_add_epi64(_mm256_add_epi64(h, _mm256_slli_epi64(h, 2)), _mm256_slli_epi64(h, 4)), m);
+		h = _mm256_xor_si256(h, _mm256_srli_epi64(h, 28));
+		h = _mm256_and_si256(_mm256_add_epi64(h, _mm256_slli_epi64(h, 31)), m);
+		// murmerhash64()
+		r = _mm256_xor_si256(k, _mm256_srli_epi64(k, 33));
+		r = mm256_mullo_epi64(r, c1);
+		r = _mm256_xor_si256(r, _mm256_srli_epi64(r, 33));
+		r = mm256_mullo_epi64(r, c2);
+		r = _mm256_xor_si256(r, _mm256_srli_epi64(r, 33));
+		_mm256_storeu_si256((__m256i*)&hash[i], h);
+		_mm256_storeu_si256((__m256i*)&rank[i], r);
+	}
+	return i;
+}
+#endif